@@ -0,0 +1,31 @@
+#include <stdio.h>
+
+// Input for test-options.py. Adds up 2^13 numbers with every addition
+// written out, so the cancellation at the end gets reported with an
+// expression over a hundred kilobytes long, bigger than herbgrind's
+// output buffer. Run with --max-expr-block-depth=16 so the whole
+// tree is kept.
+#define SUM1(i) (xs[i] + xs[(i) + 1])
+#define SUM2(i) (SUM1(i) + SUM1((i) + 2))
+#define SUM3(i) (SUM2(i) + SUM2((i) + 4))
+#define SUM4(i) (SUM3(i) + SUM3((i) + 8))
+#define SUM5(i) (SUM4(i) + SUM4((i) + 16))
+#define SUM6(i) (SUM5(i) + SUM5((i) + 32))
+#define SUM7(i) (SUM6(i) + SUM6((i) + 64))
+#define SUM8(i) (SUM7(i) + SUM7((i) + 128))
+#define SUM9(i) (SUM8(i) + SUM8((i) + 256))
+#define SUM10(i) (SUM9(i) + SUM9((i) + 512))
+#define SUM11(i) (SUM10(i) + SUM10((i) + 1024))
+#define SUM12(i) (SUM11(i) + SUM11((i) + 2048))
+#define SUM13(i) (SUM12(i) + SUM12((i) + 4096))
+
+int main() {
+  volatile double xs[8192];
+  for (int i = 0; i < 8192; ++i){
+    xs[i] = i % 2 == 0 ? 1e16 : 1.0;
+  }
+  volatile double total = SUM13(0);
+  double lost = total - 4096 * 1e16;
+  printf("%e\n", lost);
+  return 0;
+}
@@ -0,0 +1,26 @@
+#include <stdio.h>
+
+// Input for test-options.py. The first loop only ever computes exact
+// results, so its sites should get retired; the second loses the same
+// bit on every execution. The value that gets printed comes from the
+// first execution, which every option that skips executions shadows.
+#define ITERS 2000
+
+int main() {
+  volatile double big = 1e16;
+  volatile double one = 1.0;
+  double total = 0.0;
+  double first = 0.0;
+  for (int i = 0; i < ITERS; ++i){
+    volatile double x = i;
+    total += x * 2.0;
+  }
+  for (int i = 0; i < ITERS; ++i){
+    double lost = (big + one) - big;
+    if (i == 0){
+      first = lost;
+    }
+  }
+  printf("%e %e\n", total, first);
+  return 0;
+}
@@ -0,0 +1,236 @@
+#!/usr/bin/env python3
+
+# Runs each input twice, once without and once with one of herbgrind's
+# performance options, and checks that the two reports say the same
+# thing. Entries an option is documented to add or change are dropped
+# before comparing, and each case can check the ones it adds.
+
+import subprocess
+import sys
+import difflib
+import time
+
+VALGRIND = "./valgrind/herbgrind-install/bin/valgrind"
+
+REGRESS = "bench/option-regress.c.out"
+BIG_EXPR = "bench/big-expr.c.out"
+
+def tokenize(text):
+    i = 0
+    while i < len(text):
+        c = text[i]
+        if c.isspace():
+            i += 1
+        elif c in "()":
+            yield c
+            i += 1
+        elif c == '"':
+            j = i + 1
+            while j < len(text) and text[j] != '"':
+                j += 2 if text[j] == "\\" else 1
+            if j >= len(text):
+                raise ValueError("unterminated string")
+            yield text[i:j + 1]
+            i = j + 1
+        else:
+            j = i
+            while j < len(text) and not text[j].isspace() and text[j] not in '()"':
+                j += 1
+            yield text[i:j]
+            i = j
+
+# A truncated report leaves parens unbalanced, so parsing the whole file
+# doubles as the check that nothing was cut off.
+def parse(text):
+    stack = [[]]
+    for token in tokenize(text):
+        if token == "(":
+            stack.append([])
+        elif token == ")":
+            if len(stack) == 1:
+                raise ValueError("unbalanced close paren")
+            form = stack.pop()
+            stack[-1].append(form)
+        else:
+            stack[-1].append(token)
+    if len(stack) != 1:
+        raise ValueError("{} unclosed parens".format(len(stack) - 1))
+    return stack[0]
+
+def forms_named(forms, name):
+    return [form for form in forms
+            if isinstance(form, list) and form and form[0] == name]
+
+def field(form, name):
+    found = forms_named(form, name)
+    return found[0][1] if found else None
+
+def strip(forms, ignored):
+    return [strip(form, ignored) if isinstance(form, list) else form
+            for form in forms
+            if not (isinstance(form, list) and form and form[0] in ignored)]
+
+def show(form, indent=0):
+    if not isinstance(form, list):
+        return [" " * indent + form]
+    lines = [" " * indent + "("]
+    for sub in form:
+        lines += show(sub, indent + 2)
+    return lines + [" " * indent + ")"]
+
+def all_heads(forms):
+    for form in forms:
+        if isinstance(form, list):
+            if form and isinstance(form[0], str):
+                yield form[0]
+            yield from all_heads(form)
+
+# That the report has each of the given entries somewhere.
+def check_has(*names):
+    def check(report):
+        missing = set(names) - set(all_heads(report))
+        if missing:
+            return "missing {}".format(", ".join(sorted(missing)))
+        return None
+    return check
+
+# The sections writeRetiredSites adds. Every retirement should come
+# after exactly --retire-after clean calls, and with
+# --revive-interval, some site should be revived and then retired
+# again.
+def check_retired(retire_after, revived):
+    def check(report):
+        sites = forms_named(report, "retired-site")
+        if not sites:
+            return "no retired-site sections"
+        for site in sites:
+            if field(site, "clean-calls") != str(retire_after):
+                return "{} retired after {} clean calls, not {}".format(
+                    site[1], field(site, "clean-calls"), retire_after)
+            if field(site, "retired-at-ms") is None:
+                return "{} has no retired-at-ms".format(site[1])
+        if revived:
+            revived_sites = [site[1] for site in sites
+                             if field(site, "revived-at-ms") is not None]
+            if not revived_sites:
+                return "no site was revived"
+            if not any([site[1] for site in sites].count(addr) > 1
+                       for addr in revived_sites):
+                return "no revived site was retired again"
+        elif any(field(site, "revived-at-ms") is not None for site in sites):
+            return "a site was revived without --revive-interval"
+        return None
+    return check
+
+# That some top-level form of the report prints to at least this many
+# characters, so it couldn't have fit in the output buffer at once.
+def check_longer_than(length):
+    def check(report):
+        longest = max([len(" ".join(show(form))) for form in report] + [0])
+        if longest < length:
+            return "longest form is only {} characters".format(longest)
+        return None
+    return check
+
+# (program, flags for both runs, option flags,
+#  entries the option changes, check of the report with the option)
+CASES = [
+    (REGRESS, [], ["--retire-after=100"],
+     ["retired-site"], check_retired(100, False)),
+    (REGRESS, [], ["--retire-after=100", "--revive-interval=50"],
+     ["retired-site"], check_retired(100, True)),
+    (REGRESS, [], ["--adaptive-precision"],
+     ["precision", "imprecise-calls", "measured-calls"],
+     check_has("precision", "imprecise-calls", "measured-calls")),
+    (REGRESS, [], ["--lazy-reals"], ["measured-calls"],
+     check_has("measured-calls")),
+    (REGRESS, [], ["--sample-rate=8"],
+     ["sample-rate", "avg-error-confidence", "unsampled-calls",
+      "measured-calls"],
+     check_has("sample-rate", "unsampled-calls", "measured-calls")),
+    (REGRESS, [], ["--elide-exact-values"],
+     ["elided-calls", "measured-calls"],
+     check_has("elided-calls", "measured-calls")),
+    (REGRESS, [], ["--double-double"], [], None),
+    (REGRESS, [], ["--batch-ops", "--stats=yes"], [], None),
+    (REGRESS, [], ["--lazy-exprs"], [], None),
+    (BIG_EXPR, ["--max-expr-block-depth=16"], [], [],
+     check_longer_than(64 * 1024)),
+]
+
+def run(prog, flags, tag):
+    outfile = "{}.{}.gh".format(prog, tag)
+    command = [VALGRIND, "--tool=herbgrind", "--output-sexp",
+               "--outfile=" + outfile] + flags + [prog]
+    start = time.time()
+    proc = subprocess.Popen(command, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+    stdout, stderr = proc.communicate()
+    status = proc.poll()
+    elapsed = time.time() - start
+    if status:
+        stderr_lines = stderr.decode('utf-8').splitlines()
+        raise RuntimeError("`{}` failed (status {}).\nstderr::\n{}"
+                           .format(" ".join(command), status,
+                                   "\n".join(stderr_lines[-200:])))
+    with open(outfile) as f:
+        text = f.read()
+    # Anything herbgrind says about itself with --stats=yes, like how
+    # big op batches were.
+    for line in stderr.decode('utf-8').splitlines():
+        if "herbgrind: " in line:
+            print(line.split("herbgrind: ", 1)[1].strip(), end=" ")
+    try:
+        return parse(text), elapsed
+    except ValueError as e:
+        raise RuntimeError("Couldn't parse {} ({}).".format(outfile, e))
+
+# A case with no option flags just runs the program once and checks
+# the report.
+def test(prog, base, option, changed, check):
+    if not option:
+        print("Checking {}...".format(prog), end="")
+        try:
+            report, elapsed = run(prog, base, "base")
+        except RuntimeError as e:
+            print(e)
+            return False
+        problem = check(report) if check is not None else None
+        if problem is not None:
+            print("Bad report: {}!".format(problem))
+            return False
+        print("({:.2f}s) Report is fine.".format(elapsed))
+        return True
+    print("Comparing {} with and without `{}`...".format(prog, " ".join(option)),
+          end="")
+    try:
+        without, time_without = run(prog, base, "base")
+        with_opt, time_with = run(prog, base + option, "opt")
+    except RuntimeError as e:
+        print(e)
+        return False
+    print("({:.2f}s without, {:.2f}s with) ".format(time_without, time_with),
+          end="")
+    if check is not None:
+        problem = check(with_opt)
+        if problem is not None:
+            print("Bad report with the option: {}!".format(problem))
+            return False
+    without, with_opt = strip(without, changed), strip(with_opt, changed)
+    if without == with_opt:
+        print("Reports match.")
+        return True
+    print("Reports differ!")
+    lines_without = [l for form in without for l in show(form)]
+    lines_with = [l for form in with_opt for l in show(form)]
+    for line in difflib.unified_diff(lines_without, lines_with,
+                                     "without", "with", lineterm=""):
+        print(line)
+    return False
+
+if __name__ == "__main__":
+    success = True
+    for case in CASES:
+        if not test(*case):
+            success = False
+    if not success:
+        sys.exit(1)
@@ -31,17 +31,75 @@
 #include "pub_tool_mallocfree.h"
 #include "pub_tool_libcassert.h"
 #include "pub_tool_libcprint.h"
+#include "pub_tool_libcfile.h"
 
 BBuf* mkBBuf(int bound, char* buf){
   BBuf* res = VG_(malloc)("bounded buffer", sizeof(BBuf));
   res->bound = bound;
   res->buf = buf;
+  res->fd = -1;
+  res->start = buf;
+  res->size = bound;
   return res;
 }
+BBuf* mkFileBBuf(Int fd, int size, char* buf){
+  BBuf* res = mkBBuf(size, buf);
+  res->fd = fd;
+  return res;
+}
+
+void flushBBuf(BBuf* bbuf){
+  if (bbuf->fd < 0) return;
+  int length = bbuf->size - bbuf->bound;
+  if (length > 0){
+    VG_(write)(bbuf->fd, bbuf->start, length);
+  }
+  bbuf->buf = bbuf->start;
+  bbuf->bound = bbuf->size;
+}
 
 void printBBuf(BBuf* bbuf, const char* format, ...){
   va_list arglist;
   va_start(arglist, format);
+  if (bbuf->fd >= 0){
+    va_list retryArgs;
+    va_copy(retryArgs, arglist);
+    int printLength = VG_(vsnprintf)(bbuf->buf, bbuf->bound, format,
+                                     arglist);
+    if (printLength >= bbuf->bound){
+      // Drop the partial print, and write out what came before it.
+      flushBBuf(bbuf);
+      va_list sizedArgs;
+      va_copy(sizedArgs, retryArgs);
+      printLength = VG_(vsnprintf)(bbuf->buf, bbuf->bound, format,
+                                   sizedArgs);
+      va_end(sizedArgs);
+      if (printLength >= bbuf->bound){
+        // Too big for the buffer even when it's empty. Unlike the C99
+        // one, VG_(vsnprintf) only says how much fit, not how much it
+        // needed, so keep doubling a separate buffer until it all
+        // fits, and write that straight out.
+        int bigSize = bbuf->size;
+        char* bigBuf = NULL;
+        do {
+          bigSize *= 2;
+          bigBuf = VG_(realloc)("big print", bigBuf, bigSize);
+          va_copy(sizedArgs, retryArgs);
+          printLength = VG_(vsnprintf)(bigBuf, bigSize, format,
+                                       sizedArgs);
+          va_end(sizedArgs);
+        } while (printLength >= bigSize);
+        VG_(write)(bbuf->fd, bigBuf, printLength);
+        VG_(free)(bigBuf);
+        printLength = 0;
+      }
+    }
+    va_end(retryArgs);
+    va_end(arglist);
+    bbuf->bound -= printLength;
+    bbuf->buf += printLength;
+    return;
+  }
   int printLength = VG_(vsnprintf)(bbuf->buf, bbuf->bound, format,
                                    arglist);
   if (printLength >= bbuf->bound){
@@ -30,12 +30,25 @@
 #ifndef _BBUF_H
 #define _BBUF_H
 
+#include "pub_tool_basics.h"
+
+// A bounded buffer. Normally it's an error to print past the end,
+// but buffers made with mkFileBBuf instead write themselves out to
+// their file whenever they fill up, so they can take any amount of
+// output.
 typedef struct {
   int bound;
   char* buf;
+  // For file buffers, the file to flush to (-1 otherwise), and the
+  // start and size of the buffer.
+  Int fd;
+  char* start;
+  int size;
 } BBuf;
 
 BBuf* mkBBuf(int bound, char* buf);
+BBuf* mkFileBBuf(Int fd, int size, char* buf);
 void printBBuf(BBuf* bbuf, const char* format, ...);
+void flushBBuf(BBuf* bbuf);
 
 #endif
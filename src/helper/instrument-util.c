@@ -43,6 +43,11 @@ IRExpr* runLoad32(IRSB* sbOut, IRExpr* address){
   addStmtToIRSB(sbOut, IRStmt_WrTmp(dest, IRExpr_Load(ENDIAN, Ity_I32, address)));
   return IRExpr_RdTmp(dest);
 }
+IRExpr* runLoad8(IRSB* sbOut, IRExpr* address){
+  IRTemp dest = newIRTemp(sbOut->tyenv, Ity_I8);
+  addStmtToIRSB(sbOut, IRStmt_WrTmp(dest, IRExpr_Load(ENDIAN, Ity_I8, address)));
+  return IRExpr_RdTmp(dest);
+}
 IRExpr* runLoad128(IRSB* sbOut, IRExpr* address){
   IRTemp dest = newIRTemp(sbOut->tyenv, Ity_V128);
   addStmtToIRSB(sbOut, IRStmt_WrTmp(dest, IRExpr_Load(ENDIAN, Ity_V128, address)));
@@ -45,6 +45,7 @@
 #define mkU128(x) IRExpr_Const(IRConst_V128(x))
 #define mkU64(x) IRExpr_Const(IRConst_U64(x))
 #define mkU32(x) IRExpr_Const(IRConst_U32(x))
+#define mkU8(x) IRExpr_Const(IRConst_U8(x))
 #define mkU1(x) IRExpr_Const(IRConst_U1(x))
 
 IRExpr* runLoad64(IRSB* sbOut, IRExpr* address);
@@ -54,6 +55,7 @@ IRExpr* runLoadG64(IRSB* sbOut, IRExpr* address, IRExpr* guard);
 #define runLoadG64C(sbOut, addr_const, guard)      \
   runLoadG64(sbOut, mkU64((uintptr_t)addr_const), guard)
 IRExpr* runLoad32(IRSB* sbOut, IRExpr* address);
+IRExpr* runLoad8(IRSB* sbOut, IRExpr* address);
 IRExpr* runLoad128(IRSB* sbOut, IRExpr* address);
 
 #define addStore(sbOut, src_expr, dest_addr) \
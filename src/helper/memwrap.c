@@ -0,0 +1,175 @@
+/*--------------------------------------------------------------------*/
+/*--- Herbgrind: a valgrind tool for Herbie              memwrap.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Herbgrind, a valgrind tool for diagnosing
+   floating point accuracy problems in binary programs and extracting
+   problematic expressions.
+
+   Copyright (C) 2016-2017 Alex Sanchez-Stern
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 3 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#include "pub_tool_clreq.h"
+#include "pub_tool_redir.h"
+
+#include <stddef.h>
+#include <malloc.h>
+
+#include "../include/herbgrind.h"
+
+// This file instructs valgrind to capture calls to the libc bulk
+// memory functions. Left alone, a memcpy of a double array goes
+// through the client's integer or vector loads and stores, which
+// drops the shadows, and costs us a dirty call per block for every
+// one that had a shadow. Instead, we pass the whole operation to the
+// tool through a client request, which does the bytes and the shadow
+// memory for the range in one pass.
+
+// If the tool can't do the operation (because the memory isn't
+// accessible), we do it here, so that the client faults the way it
+// would have natively.
+static void* fallbackMemmove(void* dest, const void* src, size_t n){
+  unsigned char* d = dest;
+  const unsigned char* s = src;
+  if (d < s){
+    for(size_t i = 0; i < n; ++i){
+      d[i] = s[i];
+    }
+  } else {
+    for(size_t i = n; i > 0; --i){
+      d[i - 1] = s[i - 1];
+    }
+  }
+  return dest;
+}
+static void* fallbackMemset(void* dest, int c, size_t n){
+  unsigned char* d = dest;
+  for(size_t i = 0; i < n; ++i){
+    d[i] = (unsigned char)c;
+  }
+  return dest;
+}
+
+/*----------------------------
+====== memcpy/memmove ========
+----------------------------*/
+
+#define WRAP_MEMMOVE(soname, fnname)                                    \
+  void* VG_REPLACE_FUNCTION_ZU(soname, fnname)(void* dest,             \
+                                               const void* src,        \
+                                               size_t n);              \
+  void* VG_REPLACE_FUNCTION_ZU(soname, fnname)(void* dest,             \
+                                               const void* src,        \
+                                               size_t n){              \
+    if (!HERBGRIND_MEMMOVE(dest, src, n)){                              \
+      fallbackMemmove(dest, src, n);                                    \
+    }                                                                   \
+    return dest;                                                        \
+  }
+#define WRAP_MEMMOVE_CHK(soname, fnname)                                \
+  void* VG_REPLACE_FUNCTION_ZU(soname, fnname)(void* dest,             \
+                                               const void* src,        \
+                                               size_t n,               \
+                                               size_t destlen);        \
+  void* VG_REPLACE_FUNCTION_ZU(soname, fnname)(void* dest,             \
+                                               const void* src,        \
+                                               size_t n,               \
+                                               size_t destlen){        \
+    if (!HERBGRIND_MEMMOVE(dest, src, n)){                              \
+      fallbackMemmove(dest, src, n);                                    \
+    }                                                                   \
+    return dest;                                                        \
+  }
+
+// memcpy doesn't have to handle overlap, but it doesn't hurt to, and
+// plenty of programs get it wrong anyway.
+WRAP_MEMMOVE(VG_Z_LIBC_SONAME, memcpy)
+WRAP_MEMMOVE(VG_Z_LIBC_SONAME, memmove)
+WRAP_MEMMOVE_CHK(VG_Z_LIBC_SONAME, __memcpy_chk)
+WRAP_MEMMOVE_CHK(VG_Z_LIBC_SONAME, __memmove_chk)
+
+/*----------------------------
+====== memset ================
+----------------------------*/
+
+void* VG_REPLACE_FUNCTION_ZU(VG_Z_LIBC_SONAME, memset)(void* dest, int c,
+                                                       size_t n);
+void* VG_REPLACE_FUNCTION_ZU(VG_Z_LIBC_SONAME, memset)(void* dest, int c,
+                                                       size_t n){
+  if (!HERBGRIND_MEMSET(dest, c, n)){
+    fallbackMemset(dest, c, n);
+  }
+  return dest;
+}
+void* VG_REPLACE_FUNCTION_ZU(VG_Z_LIBC_SONAME, __memset_chk)(void* dest,
+                                                             int c,
+                                                             size_t n,
+                                                             size_t destlen);
+void* VG_REPLACE_FUNCTION_ZU(VG_Z_LIBC_SONAME, __memset_chk)(void* dest,
+                                                             int c,
+                                                             size_t n,
+                                                             size_t destlen){
+  if (!HERBGRIND_MEMSET(dest, c, n)){
+    fallbackMemset(dest, c, n);
+  }
+  return dest;
+}
+
+/*----------------------------
+====== realloc ===============
+----------------------------*/
+
+// We don't want to replace the allocator, so this one is a wrapper:
+// the real realloc does the work, and then we tell the tool where the
+// block went so it can bring the shadows along.
+void* VG_WRAP_FUNCTION_ZU(VG_Z_LIBC_SONAME, realloc)(void* ptr, size_t size);
+void* VG_WRAP_FUNCTION_ZU(VG_Z_LIBC_SONAME, realloc)(void* ptr, size_t size){
+  OrigFn fn;
+  void* result;
+  // This has to come before any other calls.
+  VALGRIND_GET_ORIG_FN(fn);
+  size_t oldSize = ptr == NULL ? 0 : malloc_usable_size(ptr);
+  CALL_FN_W_WW(result, fn, ptr, size);
+  if (ptr != NULL && (result != NULL || size == 0)){
+    HERBGRIND_REALLOC(ptr, oldSize, result, size);
+  }
+  return result;
+}
+
+/*----------------------------
+====== free ==================
+----------------------------*/
+
+// Shadows of freed heap blocks would otherwise live (along with their
+// expressions and reals) until something else got stored to the same
+// address, so tell the tool to reclaim them. We don't need to watch
+// malloc as well, since nothing can get shadowed in a block between
+// when it's freed and when it's handed out again.
+void VG_WRAP_FUNCTION_ZU(VG_Z_LIBC_SONAME, free)(void* ptr);
+void VG_WRAP_FUNCTION_ZU(VG_Z_LIBC_SONAME, free)(void* ptr){
+  OrigFn fn;
+  // This has to come before any other calls.
+  VALGRIND_GET_ORIG_FN(fn);
+  if (ptr != NULL){
+    HERBGRIND_FREE(ptr, malloc_usable_size(ptr));
+  }
+  CALL_FN_v_W(fn, ptr);
+}
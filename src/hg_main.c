@@ -34,10 +34,14 @@
 #include "instrument/instrument.h"
 #include "runtime/shadowop/mathreplace.h"
 #include "runtime/shadowop/influence-op.h"
+#include "runtime/shadowop/shadowop.h"
 #include "runtime/op-shadowstate/marks.h"
 #include "runtime/op-shadowstate/output.h"
+#include "runtime/wrap/mem-intercept.h"
+#include "runtime/value-shadowstate/value-shadowstate.h"
 
 #include "helper/mpfr-valgrind-glue.h"
+#include "pub_tool_libcprint.h"
 
 // This handles client requests, the macros that client programs stick
 // in to send messages to the tool.
@@ -74,6 +78,19 @@ static Bool hg_handle_client_request(ThreadId tid, UWord* arg, UWord* ret) {
   case VG_USERREQ__FORCE_TRACK:
     forceTrack((Addr)arg[1]);
     break;
+  case VG_USERREQ__MEMMOVE:
+    *ret = performWrappedMemmove((Addr)arg[1], (Addr)arg[2], (SizeT)arg[3]);
+    return True;
+  case VG_USERREQ__MEMSET:
+    *ret = performWrappedMemset((Addr)arg[1], (Int)arg[2], (SizeT)arg[3]);
+    return True;
+  case VG_USERREQ__REALLOC:
+    performWrappedRealloc((Addr)arg[1], (SizeT)arg[2],
+                          (Addr)arg[3], (SizeT)arg[4]);
+    break;
+  case VG_USERREQ__FREE:
+    performWrappedFree((Addr)arg[1], (SizeT)arg[2]);
+    break;
   default:
     return False;
   }
@@ -86,9 +103,20 @@ static void hg_fini(Int exitcode){
   finish_instrumentation();
   writeOutput();
 }
+// This is called after the program exits if --stats=yes is passed.
+static void hg_print_stats(void){
+  printMemReclaimStats();
+  printShadowFilterStats();
+  printOpBatchStats();
+}
 // This does any initialization that needs to be done after command
 // line processing.
 static void hg_post_clo_init(void){
+  if (adaptive_precision && no_exprs){
+    VG_(umsg)("Warning: --adaptive-precision works off of expressions, "
+              "so with --no-exprs every operation stays at the "
+              "starting precision.\n");
+  }
   init_instrumentation();
 }
 
@@ -111,6 +139,14 @@ static void hg_pre_clo_init(void)
    VG_(needs_command_line_options)(hg_process_cmd_line_option,
                                    hg_print_usage,
                                    hg_print_debug_usage);
+   VG_(needs_print_stats)      (hg_print_stats);
+
+   // Reclaim the shadows of memory that dies, so they don't stay
+   // alive until something else happens to get stored there.
+   VG_(track_die_mem_stack)       (dieMemShadows);
+   VG_(track_die_mem_stack_signal)(dieMemShadows);
+   VG_(track_die_mem_munmap)      (dieMemShadows);
+   VG_(track_die_mem_brk)         (dieMemShadows);
    setup_mpfr_valgrind_glue();
 }
 
@@ -42,7 +42,8 @@
 static void hg_post_clo_init(void);
 // This is called after the program exits, for cleanup and such.
 static void hg_fini(Int exitcode);
-// This is called after the program exits, for cleanup and such.
+// This is called after the program exits if --stats=yes is passed.
+static void hg_print_stats(void);
 // This handles client requests, the macros that client programs stick
 // in to send messages to the tool.
 static Bool hg_handle_client_request(ThreadId tid, UWord* arg, UWord* ret);
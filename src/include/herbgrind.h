@@ -48,6 +48,11 @@ typedef enum {
   VG_USERREQ__MARK_IMPORTANT,
   VG_USERREQ__MAYBE_MARK_IMPORTANT,
   VG_USERREQ__MAYBE_MARK_IMPORTANT_WITH_INDEX,
+
+  VG_USERREQ__MEMMOVE,
+  VG_USERREQ__MEMSET,
+  VG_USERREQ__REALLOC,
+  VG_USERREQ__FREE,
 } Vg_HerbgrindClientRequests;
 
 typedef enum {
@@ -141,4 +146,37 @@ typedef enum {
                                  &(_qzz_var), argIdx, nargs, 0, 0);      \
       _qzz_res;                                                 \
     }))
+
+// These are used by the libc memory function wrappers in
+// helper/memwrap.c, and return 1 if the tool did the operation.
+#define HERBGRIND_MEMMOVE(_qzz_dest, _qzz_src, _qzz_size)              \
+  (__extension__({unsigned long _qzz_res;                               \
+      VALGRIND_DO_CLIENT_REQUEST(_qzz_res, 0,                           \
+                                 VG_USERREQ__MEMMOVE,                   \
+                                 _qzz_dest, _qzz_src, _qzz_size, 0, 0); \
+      _qzz_res;                                                         \
+    }))
+#define HERBGRIND_MEMSET(_qzz_dest, _qzz_c, _qzz_size)                 \
+  (__extension__({unsigned long _qzz_res;                               \
+      VALGRIND_DO_CLIENT_REQUEST(_qzz_res, 0,                           \
+                                 VG_USERREQ__MEMSET,                    \
+                                 _qzz_dest, _qzz_c, _qzz_size, 0, 0);   \
+      _qzz_res;                                                         \
+    }))
+#define HERBGRIND_REALLOC(_qzz_old, _qzz_old_size,                     \
+                          _qzz_new, _qzz_new_size)                      \
+  (__extension__({unsigned long _qzz_res;                               \
+      VALGRIND_DO_CLIENT_REQUEST(_qzz_res, 0,                           \
+                                 VG_USERREQ__REALLOC,                   \
+                                 _qzz_old, _qzz_old_size,               \
+                                 _qzz_new, _qzz_new_size, 0);           \
+      _qzz_res;                                                         \
+    }))
+#define HERBGRIND_FREE(_qzz_block, _qzz_size)                          \
+  (__extension__({unsigned long _qzz_res;                               \
+      VALGRIND_DO_CLIENT_REQUEST(_qzz_res, 0,                           \
+                                 VG_USERREQ__FREE,                      \
+                                 _qzz_block, _qzz_size, 0, 0, 0);       \
+      _qzz_res;                                                         \
+    }))
 #endif
@@ -347,7 +347,6 @@ void instrumentConversion(IRSB* sbOut, IROp op_code, IRExpr** argExprs,
                         shadowInputs[1],
                         mkU64(argExprs[0]->Iex.RdTmp.tmp),
                         mkU64((uintptr_t)computedArgs.argValues[0]));
-        cleanupAtEndOfBlock(sbOut, argExprs[0]->Iex.RdTmp.tmp);
       } else if (inputsPreexistingStatic[1] == DefinitelyFalse){
         tl_assert(inputsPreexistingDynamic[0]);
         shadowOutput =
@@ -356,7 +355,6 @@ void instrumentConversion(IRSB* sbOut, IROp op_code, IRExpr** argExprs,
                         shadowInputs[0],
                         mkU64(argExprs[1]->Iex.RdTmp.tmp),
                         argExprs[1]);
-        cleanupAtEndOfBlock(sbOut, argExprs[1]->Iex.RdTmp.tmp);
       } else {
         // Otherwise we couldn't infer types statically, so we have to
         // use guarded dynamic calls depending on which one(s) already
@@ -385,7 +383,6 @@ void instrumentConversion(IRSB* sbOut, IROp op_code, IRExpr** argExprs,
                           shadowInputs[1],
                           mkU64(argExprs[0]->Iex.RdTmp.tmp),
                           mkU64((uintptr_t)computedArgs.argValues[0]));
-          cleanupAtEndOfBlock(sbOut, argExprs[0]->Iex.RdTmp.tmp);
         } else {
           tl_assert(shadowInputs[1]);
           result1 =
@@ -408,7 +405,6 @@ void instrumentConversion(IRSB* sbOut, IROp op_code, IRExpr** argExprs,
                           shadowInputs[0],
                           mkU64(argExprs[1]->Iex.RdTmp.tmp),
                           argExprs[1]);
-          cleanupAtEndOfBlock(sbOut, argExprs[1]->Iex.RdTmp.tmp);
         } else {
           tl_assert(shadowInputs[0]);
           result2 =
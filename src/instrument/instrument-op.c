@@ -33,6 +33,8 @@
 
 #include "pub_tool_libcprint.h"
 
+#include "libvex_guest_amd64.h"
+
 #include "instrument-op.h"
 #include "instrument-storage.h"
 #include "conversion.h"
@@ -102,19 +104,38 @@ void instrumentOp(IRSB* sbOut, IRTemp dest, IRExpr* expr,
     tl_assert(0);
     return;
   }
+  // Only semantic ops can be batched, so the other float ops run the
+  // batch first if they look at any of its temps.
+  Bool argsNeedOpBatch = False;
+  for(int i = 0; i < nargs; ++i){
+    if (exprNeedsOpBatch(argExprs[i])){
+      argsNeedOpBatch = True;
+    }
+  }
   // If the op isn't a float op, dont shadow it.
   if (isSpecialOp(op_code)){
+    if (argsNeedOpBatch){
+      flushOpBatch(sbOut);
+    }
     handleSpecialOp(sbOut, op_code, argExprs, dest,
                     curAddr, blockAddr);
   } else if (isExitFloatOp(op_code)){
     if (mark_on_escape){
+      if (argsNeedOpBatch){
+        flushOpBatch(sbOut);
+      }
       handleExitFloatOp(sbOut, op_code, argExprs, dest,
                         curAddr, blockAddr);
     }
   } else if (isFloatOp(op_code)){
     if (isConversionOp(op_code)){
+      if (argsNeedOpBatch){
+        flushOpBatch(sbOut);
+      }
       instrumentConversion(sbOut, op_code, argExprs, dest,
                            instrIdx);
+    } else if (retire_after > 0 && isSiteRetired(curAddr, op_code)){
+      instrumentRetiredOp(sbOut, dest);
     } else {
       instrumentSemanticOp(sbOut, op_code, nargs, argExprs,
                            curAddr, blockAddr, dest);
@@ -132,6 +153,54 @@ void instrumentOp(IRSB* sbOut, IRTemp dest, IRExpr* expr,
     addStoreTempNonFloat(sbOut, dest);
   }
 }
+// Retired sites run as plain client operations, so whatever uses
+// their results starts over from the client value. All they do is
+// count towards the next revival.
+void instrumentRetiredOp(IRSB* sbOut, IRTemp dest){
+  addStoreTempNonFloat(sbOut, dest);
+  if (revive_interval == 0){
+    return;
+  }
+  IRExpr* newCountdown =
+    runBinop(sbOut, Iop_Sub32,
+             runLoad32(sbOut, mkU64((uintptr_t)&reviveCountdown)),
+             mkU32(1));
+  addStoreC(sbOut, newCountdown, &reviveCountdown);
+  IRExpr* shouldRevive =
+    runBinop(sbOut, Iop_CmpEQ32, newCountdown, mkU32(0));
+  addStmtToIRSB(sbOut,
+                mkDirtyG_0_N(0, "reviveRetiredSites", reviveRetiredSites,
+                             mkIRExprVec_0(), shouldRevive));
+}
+// Retiring and reviving sites can't throw out translations from the
+// helpers that decide to, so instead each block starts by checking
+// for a queued range, and if there is one, goes back to the scheduler
+// to discard it before starting over at the same address.
+void addPendingDiscardExit(IRSB* sbOut, Addr blockStart){
+  IRExpr* discardLen =
+    runLoad64(sbOut, mkU64((uintptr_t)&nextDiscardLen));
+  IRExpr* discardAddr =
+    runLoad64(sbOut, mkU64((uintptr_t)&nextDiscardAddr));
+  IRExpr* shouldDiscard =
+    runBinop(sbOut, Iop_CmpNE64, discardLen, mkU64(0));
+  addStmtToIRSB(sbOut,
+                mkDirtyG_0_N(0, "advancePendingDiscards",
+                             advancePendingDiscards,
+                             mkIRExprVec_0(), shouldDiscard));
+  // Nothing else in the block has run yet, and these are only read
+  // on the way out through an InvalICache exit, so they can be set
+  // whether or not we take it.
+  addStmtToIRSB(sbOut,
+                IRStmt_Put(offsetof(VexGuestAMD64State, guest_CMSTART),
+                           discardAddr));
+  addStmtToIRSB(sbOut,
+                IRStmt_Put(offsetof(VexGuestAMD64State, guest_CMLEN),
+                           discardLen));
+  addStmtToIRSB(sbOut,
+                IRStmt_Exit(shouldDiscard, Ijk_InvalICache,
+                            IRConst_U64(blockStart),
+                            offsetof(VexGuestAMD64State, guest_RIP)));
+}
 void handleExitFloatOp(IRSB* sbOut, IROp op_code,
                        IRExpr** argExprs, IRTemp dest,
                        Addr curAddr, Addr blockAddr){
@@ -162,13 +231,11 @@ void handleExitFloatOp(IRSB* sbOut, IROp op_code,
                    ((void*)computedArgs.argValues[i])));
         if (argExprs[i]->tag == Iex_RdTmp){
           info->argTemps[i] = argExprs[i]->Iex.RdTmp.tmp;
-          cleanupAtEndOfBlock(sbOut, info->argTemps[i]);
         } else {
           info->argTemps[i] = -1;
         }
       }
       addStoreC(sbOut, IRExpr_RdTmp(dest), &computedResult);
-      cleanupAtEndOfBlock(sbOut, dest);
 
       IRDirty* dirty =
         unsafeIRDirty_0_N(1, "checkCompare",
@@ -270,12 +337,10 @@ void handleExitFloatOp(IRSB* sbOut, IROp op_code,
                  ((void*)computedArgs.argValues[0])));
       if (argExprs[1]->tag == Iex_RdTmp){
         argTemp = argExprs[1]->Iex.RdTmp.tmp;
-        cleanupAtEndOfBlock(sbOut, argTemp);
       } else {
         argTemp = -1;
       }
       addStoreC(sbOut, IRExpr_RdTmp(dest), &computedResult);
-      cleanupAtEndOfBlock(sbOut, dest);
 
       IRDirty* dirty =
         unsafeIRDirty_0_N(2, "checkConvert",
@@ -41,6 +41,9 @@ void handleSpecialOp(IRSB* sbOut, IROp op_code,
                      IRExpr** argExprs, IRTemp dest,
                      Addr curAddr, Addr blockAddr);
 
+void instrumentRetiredOp(IRSB* sbOut, IRTemp dest);
+void addPendingDiscardExit(IRSB* sbOut, Addr blockStart);
+
 void handleExitFloatOp(IRSB* sbOut, IROp op_code,
                        IRExpr** argExprs, IRTemp dest,
                        Addr curAddr, Addr blockAddr);
@@ -41,9 +41,9 @@
 #include "pub_tool_mallocfree.h"
 #include "pub_tool_libcbase.h"
 #include "pub_tool_threadstate.h"
+#include "pub_tool_options.h"
 
 void initInstrumentationState(void){
-  initOwnership();
   initValueShadowState();
   initOpShadowState();
   initTypeState();
@@ -508,11 +508,24 @@ void instrumentCAS(IRSB* sbOut,
 }
 void finishInstrumentingBlock(IRSB* sbOut){
   resetTypeState();
-  cleanupBlockOwnership(sbOut, mkU1(True));
-  resetOwnership(sbOut);
 }
-void addBlockCleanupG(IRSB* sbOut, IRExpr* guard){
-  cleanupBlockOwnership(sbOut, guard);
+// The generation of the block being instrumented, which every temp
+// load and store in it checks against.
+static IRExpr* blockTempGen = NULL;
+void addNewTempGeneration(IRSB* sbOut){
+  blockTempGen = runBinop(sbOut, Iop_Add64,
+                          runLoad64C(sbOut, &curTempGen), mkU64(1));
+  addStoreC(sbOut, blockTempGen, &curTempGen);
+
+  IRExpr* shouldReclaim =
+    runBinop(sbOut, Iop_CmpLE64U, mkU64(STALE_TEMP_BATCH),
+             runLoad64C(sbOut, &numStaleTemps));
+  IRDirty* reclaimDirty =
+    unsafeIRDirty_0_N(0, "reclaimStaleTemps",
+                      VG_(fnptr_to_fnentry)(reclaimStaleTemps),
+                      mkIRExprVec_0());
+  reclaimDirty->guard = shouldReclaim;
+  addStmtToIRSB(sbOut, IRStmt_Dirty(reclaimDirty));
 }
 IRExpr* runMkShadowTempValuesG(IRSB* sbOut, IRExpr* guard1,
                                IRExpr* guard32,
@@ -659,8 +672,26 @@ IRExpr* runMakeInputG(IRSB* sbOut, IRExpr* guard, IRExpr* argExpr,
   }
   return result;
 }
+IRExpr* runTempIsCurrent(IRSB* sbOut, int idx){
+  return runBinop(sbOut, Iop_CmpEQ64,
+                  runLoad64C(sbOut, &(shadowTempGens[idx])),
+                  blockTempGen);
+}
 IRExpr* runLoadTemp(IRSB* sbOut, int idx){
-  return runLoad64C(sbOut, &(shadowTemps[idx]));
+  IRExpr* temp = runLoad64C(sbOut, &(shadowTemps[idx]));
+  return runITE(sbOut, runTempIsCurrent(sbOut, idx), temp, mkU64(0));
+}
+// Whatever is in the slot now is a temp from an earlier run of some
+// block, so it goes on the stale stack before we overwrite it.
+void addRetireTempG(IRSB* sbOut, IRExpr* guard, int idx){
+  IRExpr* oldTemp = runLoad64C(sbOut, &(shadowTemps[idx]));
+  IRExpr* shouldRetire =
+    runAnd(sbOut, guard, runNonZeroCheck64(sbOut, oldTemp));
+  addStackPushG(sbOut, shouldRetire, staleTemps, oldTemp);
+  IRExpr* newStaleCount =
+    runBinop(sbOut, Iop_Add64,
+             runLoad64C(sbOut, &numStaleTemps), mkU64(1));
+  addStoreGC(sbOut, shouldRetire, newStaleCount, &numStaleTemps);
 }
 IRExpr* runGetTSVal(IRSB* sbOut, Int tsSrc, int instrIdx){
   tl_assert(tsAddrCanBeShadowed(tsSrc, instrIdx));
@@ -750,8 +781,9 @@ void addStoreTemp(IRSB* sbOut, IRExpr* shadow_temp,
     IRExpr* tempNonNull = runNonZeroCheck64(sbOut, shadow_temp);
     addPrintG3(tempNonNull, "[1] storing %p in t%d\n", shadow_temp, mkU64(idx));
   }
+  addRetireTempG(sbOut, mkU1(True), idx);
   addStoreC(sbOut, shadow_temp, &(shadowTemps[idx]));
-  cleanupAtEndOfBlock(sbOut, idx);
+  addStoreC(sbOut, blockTempGen, &(shadowTempGens[idx]));
 }
 void addStoreTempG(IRSB* sbOut, IRExpr* guard, IRExpr* shadow_temp,
                    int idx){
@@ -760,8 +792,9 @@ void addStoreTempG(IRSB* sbOut, IRExpr* guard, IRExpr* shadow_temp,
     IRExpr* shouldPrint = runAnd(sbOut, tempNonNull, guard);
     addPrintG3(shouldPrint, "[2] storing %p in t%d\n", shadow_temp, mkU64(idx));
   }
+  addRetireTempG(sbOut, guard, idx);
   addStoreGC(sbOut, guard, shadow_temp, &(shadowTemps[idx]));
-  cleanupAtEndOfBlock(sbOut, idx);
+  addStoreGC(sbOut, guard, blockTempGen, &(shadowTempGens[idx]));
 }
 void addStoreTempNonFloat(IRSB* sbOut, int idx){
   if (PRINT_TYPES){
@@ -773,77 +806,136 @@ void addStoreTempUnknown(IRSB* sbOut, IRExpr* shadow_temp_maybe,
                          int idx){
   addStoreTemp(sbOut, shadow_temp_maybe, idx);
 }
-IRExpr* getBucketAddr(IRSB* sbOut, IRExpr* memAddr){
-  IRExpr* bucket = runMod(sbOut, memAddr, mkU32(LARGE_PRIME));
+// Shadow memory is looked up with two loads, one from the primary
+// map to get the secondary map for the page, and one from the
+// secondary map to get the slot. Addresses above the part of the
+// address space covered by the primary map get flagged, so that the
+// caller can go to C to look them up in the auxiliary map.
+IRExpr* getSecondaryMapAddr(IRSB* sbOut, IRExpr* memAddr){
+  IRExpr* primaryIdx =
+    runBinop(sbOut, Iop_And64,
+             runBinop(sbOut, Iop_Shr64, memAddr, mkU8(SHADOW_PAGE_BITS)),
+             mkU64(SHADOW_PRIMARY_SIZE - 1));
   return runBinop(sbOut, Iop_Add64,
-                  mkU64((uintptr_t)shadowMemTable),
-                  runBinop(sbOut, Iop_Mul64,
-                           bucket,
-                           mkU64(sizeof(TableValueEntry*))));
+                  mkU64((uintptr_t)shadowPrimaryMap),
+                  runBinop(sbOut, Iop_Shl64, primaryIdx, mkU8(3)));
+}
+IRExpr* getSlotAddr(IRSB* sbOut, IRExpr* secondary, IRExpr* memAddr){
+  // The slot index is the page offset divided by four, and each slot
+  // is eight bytes, so this is just the (four byte aligned) page
+  // offset times two.
+  IRExpr* slotOffset =
+    runBinop(sbOut, Iop_Shl64,
+             runBinop(sbOut, Iop_And64, memAddr,
+                      mkU64((SHADOW_PAGE_SIZE - 1) & ~3UL)),
+             mkU8(1));
+  return runBinop(sbOut, Iop_Add64,
+                  runArrowAddr(sbOut, secondary, ShadowSecondaryMap, vals),
+                  slotOffset);
+}
+IRExpr* runOffMapCheck32(IRSB* sbOut, IRExpr* memAddr){
+  return runUnop(sbOut, Iop_1Uto32,
+                 runNonZeroCheck64(sbOut,
+                                   runBinop(sbOut, Iop_Shr64, memAddr,
+                                            mkU8(SHADOW_MAP_BITS))));
+}
+// Test the presence filter bit for the chunk holding memAddr. The
+// result is false only if there's definitely no shadow there.
+// Addresses off the primary map aren't covered by the filter, so
+// they always might have one.
+IRExpr* runMayHaveShadow(IRSB* sbOut, IRExpr* memAddr){
+  IRExpr* chunkIdx =
+    runBinop(sbOut, Iop_Shr64, memAddr, mkU8(SHADOW_FILTER_CHUNK_BITS));
+  IRExpr* byteAddr =
+    runBinop(sbOut, Iop_Add64,
+             mkU64((uintptr_t)shadowPresenceFilter),
+             runBinop(sbOut, Iop_And64,
+                      runBinop(sbOut, Iop_Shr64, chunkIdx, mkU8(3)),
+                      mkU64(SHADOW_FILTER_SIZE - 1)));
+  IRExpr* filterByte_32 =
+    runUnop(sbOut, Iop_8Uto32, runLoad8(sbOut, byteAddr));
+  IRExpr* bitIdx =
+    runUnop(sbOut, Iop_64to8,
+            runBinop(sbOut, Iop_And64, chunkIdx, mkU64(7)));
+  IRExpr* bit_32 =
+    runBinop(sbOut, Iop_And32,
+             runBinop(sbOut, Iop_Shr32, filterByte_32, bitIdx),
+             mkU32(1));
+  return runUnop(sbOut, Iop_32to1,
+                 runBinop(sbOut, Iop_Or32, bit_32,
+                          runOffMapCheck32(sbOut, memAddr)));
+}
+// Like runMayHaveShadow, but for every block of an access, and only
+// if the guard is true; otherwise the access isn't happening, so
+// there's nothing to have, or count.
+IRExpr* runMayHaveShadowRangeG(IRSB* sbOut, IRExpr* guard,
+                               FloatBlocks size, IRExpr* memAddr){
+  // Accesses are much smaller than a filter chunk, so they can touch
+  // at most two, the one with their first block and the one with
+  // their last.
+  IRExpr* result = runMayHaveShadow(sbOut, memAddr);
+  if (INT(size) > 1){
+    result =
+      runOr(sbOut, result,
+            runMayHaveShadow(sbOut,
+                             runBinop(sbOut, Iop_Add64, memAddr,
+                                      mkU64((INT(size) - 1) *
+                                            sizeof(float)))));
+  }
+  if (VG_(clo_stats)){
+    addStoreC(sbOut,
+              runBinop(sbOut, Iop_Add64,
+                       runLoad64C(sbOut, &numFilterChecks),
+                       runUnop(sbOut, Iop_1Uto64, guard)),
+              &numFilterChecks);
+    addStoreC(sbOut,
+              runBinop(sbOut, Iop_Add64,
+                       runLoad64C(sbOut, &numFilterHits),
+                       runAndto64(sbOut, guard,
+                                  runUnop(sbOut, Iop_Not1, result))),
+              &numFilterHits);
+  }
+  return runAnd(sbOut, guard, result);
 }
 
 QuickBucketResult quickGetBucket(IRSB* sbOut, IRExpr* memAddr){
   QuickBucketResult result;
-  IRExpr* bucketEntry =
-    runLoad64(sbOut, getBucketAddr(sbOut, memAddr));
-  IRExpr* entryExists =
-    runNonZeroCheck64(sbOut, bucketEntry);
-  IRExpr* entryAddr =
-    runArrowG(sbOut, entryExists, bucketEntry,
-              TableValueEntry, addr);
-  IRExpr* entryNext =
-    runArrowG(sbOut, entryExists, bucketEntry,
-              TableValueEntry, next);
-  IRExpr* addrMatches =
-    runBinop(sbOut, Iop_CmpEQ64, entryAddr, memAddr);
-  IRExpr* moreChain = runNonZeroCheck64(sbOut, entryNext);
+  IRExpr* secondary =
+    runLoad64(sbOut, getSecondaryMapAddr(sbOut, memAddr));
   result.entry =
-    runArrowG(sbOut, addrMatches, bucketEntry, TableValueEntry, val);
-  result.stillSearching32 =
-    runBinop(sbOut, Iop_And32,
-             runUnop(sbOut, Iop_1Uto32, moreChain),
-             runUnop(sbOut, Iop_Not32,
-                     runUnop(sbOut, Iop_1Uto32, addrMatches)));
+    runLoad64(sbOut, getSlotAddr(sbOut, secondary, memAddr));
+  result.offMap32 = runOffMapCheck32(sbOut, memAddr);
   return result;
 }
 QuickBucketResult quickGetBucketG(IRSB* sbOut, IRExpr* guard,
                                   IRExpr* memAddr){
   QuickBucketResult result;
-  IRExpr* bucketEntry =
-    runLoadG64(sbOut, getBucketAddr(sbOut, memAddr), guard);
-  IRExpr* entryExists = runNonZeroCheck64(sbOut, bucketEntry);
-  IRExpr* shouldDoAnything = runAnd(sbOut, entryExists, guard);
-  IRExpr* entryAddr =
-    runArrowG(sbOut, shouldDoAnything, bucketEntry,
-              TableValueEntry, addr);
-  IRExpr* entryNext =
-    runArrowG(sbOut, shouldDoAnything, bucketEntry,
-              TableValueEntry, next);
-  IRExpr* addrMatches =
-    runBinop(sbOut, Iop_CmpEQ64, entryAddr, memAddr);
-  IRExpr* moreChain = runNonZeroCheck64(sbOut, entryNext);
+  IRExpr* secondary =
+    runLoadG64(sbOut, getSecondaryMapAddr(sbOut, memAddr), guard);
   result.entry =
-    runArrowG(sbOut, addrMatches, bucketEntry, TableValueEntry, val);
-  result.stillSearching32 =
+    runLoadG64(sbOut, getSlotAddr(sbOut, secondary, memAddr), guard);
+  result.offMap32 =
     runBinop(sbOut, Iop_And32,
-             runUnop(sbOut, Iop_1Uto32, moreChain),
-             runUnop(sbOut, Iop_Not32,
-                     runUnop(sbOut, Iop_1Uto32, addrMatches)));
+             runOffMapCheck32(sbOut, memAddr),
+             runUnop(sbOut, Iop_1Uto32, guard));
   return result;
 }
 IRExpr* runGetMemUnknownG(IRSB* sbOut, IRExpr* guard,
                           FloatBlocks size, IRExpr* memSrc){
+  // Don't even look in the maps if the filter says there's nothing
+  // there.
+  guard = runMayHaveShadowRangeG(sbOut, guard, size, memSrc);
   QuickBucketResult qresults[MAX_TEMP_BLOCKS];
-  IRExpr* anyNonTrivialChains_32 = mkU32(0);
+  IRExpr* anyOffMap_32 = mkU32(0);
   IRExpr* allNull_32 = mkU32(1);
   for(int i = 0; i < INT(size); ++i){
     qresults[i] = quickGetBucketG(sbOut, guard,
                                   runBinop(sbOut, Iop_Add64, memSrc,
                                            mkU64(i * sizeof(float))));
-    anyNonTrivialChains_32 =
+    anyOffMap_32 =
       runBinop(sbOut, Iop_Or32,
-               anyNonTrivialChains_32,
-               qresults[i].stillSearching32);
+               anyOffMap_32,
+               qresults[i].offMap32);
     IRExpr* entryNull = runZeroCheck64(sbOut, qresults[i].entry);
     allNull_32 = runBinop(sbOut, Iop_And32,
                           allNull_32,
@@ -851,7 +943,7 @@ IRExpr* runGetMemUnknownG(IRSB* sbOut, IRExpr* guard,
                                   entryNull));
   }
   IRExpr* goToC = runOr(sbOut,
-                        runUnop(sbOut, Iop_32to1, anyNonTrivialChains_32),
+                        runUnop(sbOut, Iop_32to1, anyOffMap_32),
                         runUnop(sbOut, Iop_Not1,
                                 runUnop(sbOut, Iop_32to1,
                                         allNull_32)));
@@ -860,43 +952,7 @@ IRExpr* runGetMemUnknownG(IRSB* sbOut, IRExpr* guard,
                 mkU64(0));
 }
 IRExpr* runGetMemUnknown(IRSB* sbOut, FloatBlocks size, IRExpr* memSrc){
-  IRExpr* anyNonTrivialChains_32 = NULL;
-  IRExpr* allNull_32 = NULL;
-  if (INT(size) == 1){
-    QuickBucketResult qresult =
-      quickGetBucket(sbOut, memSrc);
-    IRExpr* entryNull = runZeroCheck64(sbOut, qresult.entry);
-    anyNonTrivialChains_32 = qresult.stillSearching32;
-    allNull_32 = runUnop(sbOut, Iop_1Uto32, entryNull);
-  } else {
-    QuickBucketResult qresults[MAX_TEMP_BLOCKS];
-    for(int i = 0; i < INT(size); ++i){
-      qresults[i] = quickGetBucket(sbOut,
-                                   runBinop(sbOut, Iop_Add64, memSrc,
-                                            mkU64(i * sizeof(float))));
-      IRExpr* entryNull = runZeroCheck64(sbOut, qresults[i].entry);
-      if (i == 0){
-        anyNonTrivialChains_32 = qresults[i].stillSearching32;
-        allNull_32 = runUnop(sbOut, Iop_1Uto32, entryNull);
-      } else {
-        anyNonTrivialChains_32 = runBinop(sbOut, Iop_Or32,
-                                          anyNonTrivialChains_32,
-                                          qresults[i].stillSearching32);
-        allNull_32 = runBinop(sbOut, Iop_And32, allNull_32,
-                              runUnop(sbOut, Iop_1Uto32, entryNull));
-      }
-    }
-  }
-  tl_assert(anyNonTrivialChains_32 != NULL);
-  tl_assert(allNull_32 != NULL);
-  IRExpr* goToC = runUnop(sbOut, Iop_32to1,
-                          runBinop(sbOut, Iop_Or32,
-                                   anyNonTrivialChains_32,
-                                   runUnop(sbOut, Iop_Not32,
-                                           allNull_32)));
-  return runITE(sbOut, goToC,
-                runGetMemG(sbOut, goToC, size, memSrc),
-                mkU64(0));
+  return runGetMemUnknownG(sbOut, mkU1(True), size, memSrc);
 }
 IRExpr* runGetMemG(IRSB* sbOut, IRExpr* guard, FloatBlocks size, IRExpr* memSrc){
   IRTemp result = newIRTemp(sbOut->tyenv, Ity_I64);
@@ -908,8 +964,8 @@ IRExpr* runGetMemG(IRSB* sbOut, IRExpr* guard, FloatBlocks size, IRExpr* memSrc)
                       mkIRExprVec_2(memSrc, mkU64(INT(size))));
   loadDirty->guard = guard;
   loadDirty->mFx = Ifx_Read;
-  loadDirty->mAddr = mkU64((uintptr_t)shadowMemTable);
-  loadDirty->mSize = sizeof(TableValueEntry) * LARGE_PRIME;
+  loadDirty->mAddr = mkU64((uintptr_t)shadowPrimaryMap);
+  loadDirty->mSize = sizeof(shadowPrimaryMap);
   addStmtToIRSB(sbOut, IRStmt_Dirty(loadDirty));
   return runITE(sbOut, guard, IRExpr_RdTmp(result), mkU64(0));
 }
@@ -921,8 +977,8 @@ IRExpr* runGetMem(IRSB* sbOut, FloatBlocks size, IRExpr* memSrc){
                       VG_(fnptr_to_fnentry)(dynamicLoad),
                       mkIRExprVec_2(memSrc, mkU64(INT(size))));
   loadDirty->mFx = Ifx_Read;
-  loadDirty->mAddr = mkU64((uintptr_t)shadowMemTable);
-  loadDirty->mSize = sizeof(TableValueEntry) * LARGE_PRIME;
+  loadDirty->mAddr = mkU64((uintptr_t)shadowPrimaryMap);
+  loadDirty->mSize = sizeof(shadowPrimaryMap);
   addStmtToIRSB(sbOut, IRStmt_Dirty(loadDirty));
   return IRExpr_RdTmp(result);
 }
@@ -930,20 +986,19 @@ void addClearMem(IRSB* sbOut, FloatBlocks size, IRExpr* memDest){
   addClearMemG(sbOut, mkU1(True), size, memDest);
 }
 void addClearMemG(IRSB* sbOut, IRExpr* guard, FloatBlocks size, IRExpr* memDest){
+  IRExpr* mayHaveShadow =
+    runMayHaveShadowRangeG(sbOut, guard, size, memDest);
   IRExpr* hasExistingShadow = mkU1(False);
   for(int i = 0; i < INT(size); ++i){
-    IRExpr* valDest = runBinop(sbOut, Iop_Add64, memDest,
-                               mkU64(i * sizeof(float)));
-    IRExpr* destBucket = runMod(sbOut, valDest, mkU32(LARGE_PRIME));
-    IRExpr* destBucketAddr =
-      runBinop(sbOut, Iop_Add64,
-               mkU64((uintptr_t)shadowMemTable),
-               runBinop(sbOut, Iop_Mul64,
-                        destBucket,
-                        mkU64(sizeof(TableValueEntry*))));
-    IRExpr* memEntry = runLoad64(sbOut, destBucketAddr);
-    hasExistingShadow = runOr(sbOut, hasExistingShadow,
-                              runNonZeroCheck64(sbOut, memEntry));
+    QuickBucketResult qresult =
+      quickGetBucketG(sbOut, mayHaveShadow,
+                      runBinop(sbOut, Iop_Add64, memDest,
+                               mkU64(i * sizeof(float))));
+    hasExistingShadow =
+      runOr(sbOut, hasExistingShadow,
+            runOr(sbOut,
+                  runNonZeroCheck64(sbOut, qresult.entry),
+                  runUnop(sbOut, Iop_32to1, qresult.offMap32)));
   }
   addSetMemG(sbOut,
              runAnd(sbOut, hasExistingShadow, guard),
@@ -987,8 +1042,8 @@ void addSetMemG(IRSB* sbOut, IRExpr* guard, FloatBlocks size,
                       mkIRExprVec_3(memDest, mkU64(INT(size)), newTemp));
   storeDirty->guard = guard;
   storeDirty->mFx = Ifx_Modify;
-  storeDirty->mAddr = mkU64((uintptr_t)shadowMemTable);
-  storeDirty->mSize = sizeof(TableValueEntry) * LARGE_PRIME;
+  storeDirty->mAddr = mkU64((uintptr_t)shadowPrimaryMap);
+  storeDirty->mSize = sizeof(shadowPrimaryMap);
   addStmtToIRSB(sbOut, IRStmt_Dirty(storeDirty));
 }
 IRExpr* toDoubleBytes(IRSB* sbOut, IRExpr* floatExpr){
@@ -75,7 +75,7 @@ void instrumentStoreG(IRSB* sbOut, IRExpr* addr,
 void instrumentCAS(IRSB* sbOut,
                    IRCAS* details);
 void finishInstrumentingBlock(IRSB* sbOut);
-void addBlockCleanupG(IRSB* sbOut, IRExpr* guard);
+void addNewTempGeneration(IRSB* sbOut);
 
 IRExpr* runMkShadowTempValues(IRSB* sbOut, FloatBlocks num_blocks,
                               IRExpr** values);
@@ -104,7 +104,9 @@ void addSetTSValUnknown(IRSB* sbOut, Int tsDest, IRExpr* newVal,
 void addSetTSVal(IRSB* sbOut, Int tsDest, IRExpr* newVal, int instrIdx);
 void addSetTSValDynamic(IRSB* sbOut, IRExpr* tsDest, IRExpr* newVal, int instrIdx);
 
+IRExpr* runTempIsCurrent(IRSB* sbOut, int idx);
 IRExpr* runLoadTemp(IRSB* sbOut, int idx);
+void addRetireTempG(IRSB* sbOut, IRExpr* guard, int idx);
 void addStoreTemp(IRSB* sbOut, IRExpr* shadow_temp,
                   int idx);
 void addStoreTempG(IRSB* sbOut, IRExpr* guard,
@@ -114,10 +116,15 @@ void addStoreTempNonFloat(IRSB* sbOut, int idx);
 void addStoreTempUnknown(IRSB* sbOut, IRExpr* shadow_temp_maybe, int idx);
 void addStoreTempCopy(IRSB* sbOut, IRExpr* original, IRTemp dest);
 
-IRExpr* getBucketAddr(IRSB* sbOut, IRExpr* memAddr);
+IRExpr* getSecondaryMapAddr(IRSB* sbOut, IRExpr* memAddr);
+IRExpr* getSlotAddr(IRSB* sbOut, IRExpr* secondary, IRExpr* memAddr);
+IRExpr* runOffMapCheck32(IRSB* sbOut, IRExpr* memAddr);
+IRExpr* runMayHaveShadow(IRSB* sbOut, IRExpr* memAddr);
+IRExpr* runMayHaveShadowRangeG(IRSB* sbOut, IRExpr* guard,
+                               FloatBlocks size, IRExpr* memAddr);
 typedef struct {
   IRExpr* entry;
-  IRExpr* stillSearching32;
+  IRExpr* offMap32;
 } QuickBucketResult;
 QuickBucketResult quickGetBucket(IRSB* sbOut, IRExpr* memAddr);
 QuickBucketResult quickGetBucketG(IRSB* sbOut, IRExpr* guard,
@@ -32,6 +32,7 @@
 
 #include "instrument-storage.h"
 #include "instrument-op.h"
+#include "semantic-op.h"
 
 // Pull in this header file so that we can call the valgrind version
 // of printf.
@@ -67,9 +68,7 @@ IRSB* hg_instrument (VgCallbackClosure* closure,
                   "Running block at %p\n", (void*)closure->readdr);
     addPrint(blockMessage);
   }
-  IRExpr* blockStateDirtyExpr = runLoad64C(sbOut, &blockStateDirty);
-  addAssertEQ(sbOut, "Uncleaned block!\n", blockStateDirtyExpr, mkU64(0));
-  addStoreC(sbOut, mkU64(1), &blockStateDirty);
+  addNewTempGeneration(sbOut);
 
   Addr curAddr = 0;
   Addr prevAddr = -1;
@@ -89,6 +88,10 @@ IRSB* hg_instrument (VgCallbackClosure* closure,
       preInstrumentStatement(sbOut, stmt, curAddr, prevAddr);
     }
     addStmtToIRSB(sbOut, stmt);
+    if (stmt->tag == Ist_IMark && prevAddr == 0 &&
+        retire_after > 0 && !dummy){
+      addPendingDiscardExit(sbOut, curAddr);
+    }
     if (curAddr)
       instrumentStatement(sbOut, stmt,
                           curAddr, closure->readdr,
@@ -97,6 +100,7 @@ IRSB* hg_instrument (VgCallbackClosure* closure,
       addPrint2("Finished running statement %d\n", mkU64(i));
     }
   }
+  flushOpBatch(sbOut);
   finishInstrumentingBlock(sbOut);
   if (PRINT_BLOCK_BOUNDRIES){
     addPrint("\n+++++\n");
@@ -115,11 +119,70 @@ void init_instrumentation(void){
 void finish_instrumentation(void){
   cleanupTypeState();
 }
-void preInstrumentStatement(IRSB* sbOut, IRStmt* stmt, Addr stAddr, Addr prevAddr){
+// Whether the instrumentation of a statement might look at the temps
+// the ops in a batch read or write. Ops figure this out for
+// themselves in instrumentOp, since other semantic ops can read the
+// results of the ones in the batch without running it.
+static Bool needsOpBatch(IRStmt* stmt){
   switch(stmt->tag){
+  case Ist_NoOp:
+  case Ist_IMark:
+  case Ist_MBE:
+  case Ist_AbiHint:
   case Ist_Exit:
-    addBlockCleanupG(sbOut, stmt->Ist.Exit.guard);
-    break;
+    return False;
+  case Ist_Dirty:
+    {
+      IRDirty* details = stmt->Ist.Dirty.details;
+      if (exprNeedsOpBatch(details->guard)){
+        return True;
+      }
+      for(int i = 0; details->args[i] != NULL; ++i){
+        if (details->args[i]->tag == Iex_RdTmp &&
+            exprNeedsOpBatch(details->args[i])){
+          return True;
+        }
+      }
+      return False;
+    }
+  case Ist_Put:
+    return exprNeedsOpBatch(stmt->Ist.Put.data);
+  case Ist_PutI:
+    return exprNeedsOpBatch(stmt->Ist.PutI.details->ix) ||
+      exprNeedsOpBatch(stmt->Ist.PutI.details->data);
+  case Ist_WrTmp:
+    switch(stmt->Ist.WrTmp.data->tag){
+    case Iex_Qop:
+    case Iex_Triop:
+    case Iex_Binop:
+    case Iex_Unop:
+      return False;
+    default:
+      return exprNeedsOpBatch(stmt->Ist.WrTmp.data);
+    }
+  case Ist_Store:
+    return exprNeedsOpBatch(stmt->Ist.Store.addr) ||
+      exprNeedsOpBatch(stmt->Ist.Store.data);
+  case Ist_StoreG:
+    return exprNeedsOpBatch(stmt->Ist.StoreG.details->addr) ||
+      exprNeedsOpBatch(stmt->Ist.StoreG.details->data) ||
+      exprNeedsOpBatch(stmt->Ist.StoreG.details->guard);
+  case Ist_LoadG:
+    return exprNeedsOpBatch(stmt->Ist.LoadG.details->addr) ||
+      exprNeedsOpBatch(stmt->Ist.LoadG.details->alt) ||
+      exprNeedsOpBatch(stmt->Ist.LoadG.details->guard);
+  default:
+    return True;
+  }
+}
+void preInstrumentStatement(IRSB* sbOut, IRStmt* stmt, Addr stAddr, Addr prevAddr){
+  if (needsOpBatch(stmt)){
+    flushOpBatch(sbOut);
+  } else if (stmt->tag == Ist_Exit){
+    // If we leave here, the batch has to have run by then.
+    flushOpBatchG(sbOut, stmt->Ist.Exit.guard);
+  }
+  switch(stmt->tag){
   case Ist_AbiHint:
     if (stmt->Ist.AbiHint.nia->tag == Iex_Const &&
         stmt->Ist.AbiHint.nia->Iex.Const.con->tag == Ico_U64){
@@ -34,51 +34,8 @@
 #include "pub_tool_libcprint.h"
 #include "../runtime/value-shadowstate/value-shadowstate.h"
 #include "../helper/instrument-util.h"
+#include "instrument-storage.h"
 
-XArray* tempDebt;
-
-void initOwnership(void){
-  tempDebt = VG_(newXA)(VG_(malloc), "temp debt array",
-                        VG_(free), sizeof(IRTemp));
-}
-void cleanupBlockOwnership(IRSB* sbOut, IRExpr* guard){
-  if (VG_(sizeXA)(tempDebt) == 0){
-    addStoreGC(sbOut, guard, mkU64(0), &blockStateDirty);
-    return;
-  }
-  IRTemp* curDebtContents =
-    VG_(perm_malloc)(sizeof(IRTemp) * VG_(sizeXA)(tempDebt),
-                     vg_alignof(IRTemp));
-  for(int i = 0; i < VG_(sizeXA)(tempDebt); ++i){
-    curDebtContents[i] = *(IRTemp*)VG_(indexXA)(tempDebt, i);
-  }
-  IRDirty* dynCleanupDirty =
-    unsafeIRDirty_0_N(2, "dynamicCleanup",
-                      VG_(fnptr_to_fnentry)(dynamicCleanup),
-                      mkIRExprVec_2(mkU64(VG_(sizeXA)(tempDebt)),
-                                    mkU64((uintptr_t)curDebtContents)));
-  dynCleanupDirty->mFx = Ifx_Modify;
-  dynCleanupDirty->guard = guard;
-  dynCleanupDirty->mAddr = mkU64((uintptr_t)shadowTemps);
-  dynCleanupDirty->mSize = sizeof(ShadowTemp) * MAX_TEMPS;
-  addStmtToIRSB(sbOut, IRStmt_Dirty(dynCleanupDirty));
-}
-
-void resetOwnership(IRSB* sbOut){
-  VG_(deleteXA)(tempDebt);
-  tempDebt = VG_(newXA)(VG_(malloc), "temp debt array", VG_(free),
-                        sizeof(IRTemp));
-}
-
-void cleanupAtEndOfBlock(IRSB* sbOut, IRTemp shadowed_temp){
-  for(int i = 0; i < VG_(sizeXA)(tempDebt); ++i){
-    IRTemp* prevEntry = VG_(indexXA)(tempDebt, i);
-    if (*prevEntry == shadowed_temp){
-      return;
-    }
-  }
-  VG_(addToXA)(tempDebt, &shadowed_temp);
-}
 void addDynamicDisown(IRSB* sbOut, IRTemp idx){
   IRDirty* disownDirty =
     unsafeIRDirty_0_N(1, "disownShadowTempDynamic",
@@ -203,7 +160,15 @@ void addSVDisownG(IRSB* sbOut, IRExpr* guard, IRExpr* sv){
   addSVDisownNonNullG(sbOut, shouldDoAnythingAtAll, sv);
 }
 void addClear(IRSB* sbOut, IRTemp dest, int num_vals){
+  // Only a temp from this run of the block is ours to disown. One
+  // left over from an earlier run goes on the stale stack instead, so
+  // it doesn't sit in the slot until the slot is reused.
+  IRExpr* isCurrent = runTempIsCurrent(sbOut, dest);
   IRExpr* oldShadowTemp = runLoad64C(sbOut, &(shadowTemps[dest]));
-  addDisownNonNull(sbOut, oldShadowTemp, num_vals);
+  addDisownG(sbOut,
+             runAnd(sbOut, isCurrent,
+                    runNonZeroCheck64(sbOut, oldShadowTemp)),
+             oldShadowTemp, num_vals);
+  addRetireTempG(sbOut, runUnop(sbOut, Iop_Not1, isCurrent), dest);
   addStoreC(sbOut, mkU64(0), &(shadowTemps[dest]));
 }
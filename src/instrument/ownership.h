@@ -33,12 +33,6 @@
 #include "pub_tool_tooliface.h"
 #include "pub_tool_xarray.h"
 
-extern XArray* tempDebt;
-
-void initOwnership(void);
-void cleanupBlockOwnership(IRSB* sbOut, IRExpr* guard);
-void resetOwnership(IRSB* sbOut);
-void cleanupAtEndOfBlock(IRSB* sbOut, IRTemp shadowed_temp);
 void addDynamicDisown(IRSB* sbOut, IRTemp idx);
 void addDynamicDisownNonNull(IRSB* sbOut, IRTemp idx);
 void addDynamicDisownNonNullDetached(IRSB* sbOut, IRExpr* st);
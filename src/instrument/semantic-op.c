@@ -48,6 +48,17 @@
 
 VgHashTable* opInfoTable = NULL;
 
+// The ops in the batch being built for the block being instrumented.
+static ShadowOpInfoInstance* batchInstances[MAX_OP_BATCH];
+static IRTemp batchDests[MAX_OP_BATCH];
+static int numBatchOps = 0;
+// The temps whose shadows the batch might set when it runs: the ones
+// its ops write, and the ones they read, which get shadows made for
+// them if they don't have one yet, and which the instrumentation
+// after them assumes are shadowed. Anything else in the block can
+// run before the batch does.
+static Bool batchTouchesTemp[MAX_TEMPS];
+
 long int cmpSemOpInfoEntry(const void* node1, const void* node2){
   const SemOpInfoEntry* entry1 = (const SemOpInfoEntry*)node1;
   const SemOpInfoEntry* entry2 = (const SemOpInfoEntry*)node2;
@@ -59,6 +70,125 @@ long int cmpSemOpInfoEntry(const void* node1, const void* node2){
   }
 }
 
+static void addOpToBatch(IRSB* sbOut, IROp op_code,
+                         Addr curAddr, Addr block_addr,
+                         int nargs, IRExpr** argExprs,
+                         IRTemp dest){
+  if (numBatchOps == MAX_OP_BATCH){
+    flushOpBatch(sbOut);
+  }
+  ShadowOpInfoInstance* instance =
+    getSemanticOpInfoInstance(curAddr, block_addr, op_code,
+                              nargs, argExprs);
+  OpBatchSlot* slot = &(opBatchSlots[numBatchOps]);
+  for(int i = 0; i < nargs; ++i){
+    // The single and double arrays of each argument start at the
+    // same place, so we don't care which this is.
+    addStoreC(sbOut, argExprs[i], slot->args.argValues[i]);
+  }
+  addStoreC(sbOut, IRExpr_RdTmp(dest), &(slot->result));
+  batchInstances[numBatchOps] = instance;
+  batchDests[numBatchOps] = dest;
+  numBatchOps++;
+  batchTouchesTemp[dest] = True;
+  for(int i = 0; i < nargs; ++i){
+    if (instance->argTemps[i] != -1){
+      batchTouchesTemp[instance->argTemps[i]] = True;
+    }
+  }
+}
+
+Bool exprNeedsOpBatch(IRExpr* expr){
+  if (numBatchOps == 0){
+    return False;
+  }
+  switch(expr->tag){
+  case Iex_RdTmp:
+    return batchTouchesTemp[expr->Iex.RdTmp.tmp];
+  case Iex_Get:
+  case Iex_Const:
+    return False;
+  case Iex_GetI:
+    return exprNeedsOpBatch(expr->Iex.GetI.ix);
+  case Iex_Load:
+    return exprNeedsOpBatch(expr->Iex.Load.addr);
+  case Iex_Unop:
+    return exprNeedsOpBatch(expr->Iex.Unop.arg);
+  case Iex_Binop:
+    return exprNeedsOpBatch(expr->Iex.Binop.arg1) ||
+      exprNeedsOpBatch(expr->Iex.Binop.arg2);
+  case Iex_Triop:
+    return exprNeedsOpBatch(expr->Iex.Triop.details->arg1) ||
+      exprNeedsOpBatch(expr->Iex.Triop.details->arg2) ||
+      exprNeedsOpBatch(expr->Iex.Triop.details->arg3);
+  case Iex_Qop:
+    return exprNeedsOpBatch(expr->Iex.Qop.details->arg1) ||
+      exprNeedsOpBatch(expr->Iex.Qop.details->arg2) ||
+      exprNeedsOpBatch(expr->Iex.Qop.details->arg3) ||
+      exprNeedsOpBatch(expr->Iex.Qop.details->arg4);
+  case Iex_ITE:
+    return exprNeedsOpBatch(expr->Iex.ITE.cond) ||
+      exprNeedsOpBatch(expr->Iex.ITE.iftrue) ||
+      exprNeedsOpBatch(expr->Iex.ITE.iffalse);
+  case Iex_CCall:
+    for(int i = 0; expr->Iex.CCall.args[i] != NULL; ++i){
+      if (exprNeedsOpBatch(expr->Iex.CCall.args[i])){
+        return True;
+      }
+    }
+    return False;
+  default:
+    return True;
+  }
+}
+
+static void addRunOpBatch(IRSB* sbOut, IRExpr* guard){
+  OpBatch* batch = VG_(perm_malloc)(sizeof(OpBatch),
+                                    vg_alignof(OpBatch));
+  batch->numOps = numBatchOps;
+  batch->instances =
+    VG_(perm_malloc)(sizeof(ShadowOpInfoInstance*) * numBatchOps,
+                     vg_alignof(ShadowOpInfoInstance*));
+  batch->dests = VG_(perm_malloc)(sizeof(IRTemp) * numBatchOps,
+                                  vg_alignof(IRTemp));
+  for(int i = 0; i < numBatchOps; ++i){
+    batch->instances[i] = batchInstances[i];
+    batch->dests[i] = batchDests[i];
+  }
+  IRDirty* dirty =
+    unsafeIRDirty_0_N(1, "executeOpBatch",
+                      VG_(fnptr_to_fnentry)(executeOpBatch),
+                      mkIRExprVec_1(mkU64((uintptr_t)batch)));
+  dirty->mFx = Ifx_Read;
+  dirty->mAddr = mkU64((uintptr_t)opBatchSlots);
+  dirty->mSize = sizeof(OpBatchSlot) * numBatchOps;
+  dirty->guard = guard;
+  addStmtToIRSB(sbOut, IRStmt_Dirty(dirty));
+}
+
+void flushOpBatch(IRSB* sbOut){
+  if (numBatchOps == 0){
+    return;
+  }
+  addRunOpBatch(sbOut, mkU1(True));
+  for(int i = 0; i < numBatchOps; ++i){
+    batchTouchesTemp[batchDests[i]] = False;
+    for(int j = 0; j < batchInstances[i]->plan.nargs; ++j){
+      if (batchInstances[i]->argTemps[j] != -1){
+        batchTouchesTemp[batchInstances[i]->argTemps[j]] = False;
+      }
+    }
+  }
+  numBatchOps = 0;
+}
+
+void flushOpBatchG(IRSB* sbOut, IRExpr* guard){
+  if (numBatchOps == 0){
+    return;
+  }
+  addRunOpBatch(sbOut, guard);
+}
+
 void instrumentSemanticOp(IRSB* sbOut, IROp op_code,
                           int nargs, IRExpr** argExprs,
                           Addr curAddr, Addr blockAddr,
@@ -74,12 +204,33 @@ void instrumentSemanticOp(IRSB* sbOut, IROp op_code,
     addPrintOp(op_code);
     addPrint("\n");
   }
-  IRExpr* shadowOutput = runShadowOp(sbOut, mkU1(True),
-                                     op_code,
-                                     curAddr, blockAddr,
-                                     nargs, argExprs,
-                                     IRExpr_RdTmp(dest));
-  addStoreTemp(sbOut, shadowOutput, dest);
+  if (batch_ops){
+    addOpToBatch(sbOut, op_code, curAddr, blockAddr,
+                 nargs, argExprs, dest);
+  } else if (sample_rate > 1){
+    ShadowOpInfoInstance* instance =
+      getSemanticOpInfoInstance(curAddr, blockAddr, op_code,
+                                nargs, argExprs);
+    IRExpr* sampled = runSampleSite(sbOut, instance->info);
+    IRExpr* shadowOutput =
+      runShadowOpInstance(sbOut, sampled, instance,
+                          nargs, argExprs, IRExpr_RdTmp(dest));
+    addStoreTempG(sbOut, sampled, shadowOutput, dest);
+  } else {
+    IRExpr* shadowOutput = runShadowOp(sbOut, mkU1(True),
+                                       op_code,
+                                       curAddr, blockAddr,
+                                       nargs, argExprs,
+                                       IRExpr_RdTmp(dest));
+    addStoreTemp(sbOut, shadowOutput, dest);
+  }
+  // When we're sampling, skipped executions leave the output
+  // unshadowed, so that whatever uses it starts over from the client
+  // value, and we can't know statically which executions those are.
+  if (sample_rate > 1){
+    tempShadowStatus[dest] = Ss_Unknown;
+    return;
+  }
   for (int i = 0; i < nargs; ++i){
     if (argExprs[i]->tag == Iex_RdTmp){
       tempShadowStatus[argExprs[i]->Iex.RdTmp.tmp] = Ss_Shadowed;
@@ -88,17 +239,10 @@ void instrumentSemanticOp(IRSB* sbOut, IROp op_code,
   tempShadowStatus[dest] = Ss_Shadowed;
 }
 
-IRExpr* runShadowOp(IRSB* sbOut, IRExpr* guard,
-                    IROp op_code,
-                    Addr curAddr, Addr block_addr,
-                    int nargs, IRExpr** argExprs,
-                    IRExpr* result){
-  if (opInfoTable == NULL){
-    opInfoTable = VG_(HT_construct)("Operation Info Table");
-  }
-  ShadowOpInfoInstance* instance =
-    getSemanticOpInfoInstance(curAddr, block_addr, op_code,
-                              nargs, argExprs);
+static IRExpr* runShadowOpInstance(IRSB* sbOut, IRExpr* guard,
+                                   ShadowOpInfoInstance* instance,
+                                   int nargs, IRExpr** argExprs,
+                                   IRExpr* result){
   for(int i = 0; i < nargs; ++i){
     addStoreC(sbOut, argExprs[i],
               (uintptr_t)
@@ -107,15 +251,11 @@ IRExpr* runShadowOp(IRSB* sbOut, IRExpr* guard,
                ((void*)computedArgs.argValues[i])));
     if (argExprs[i]->tag == Iex_RdTmp){
       instance->argTemps[i] = argExprs[i]->Iex.RdTmp.tmp;
-      cleanupAtEndOfBlock(sbOut, argExprs[i]->Iex.RdTmp.tmp);
     } else {
       instance->argTemps[i] = -1;
     }
   }
   addStoreC(sbOut, result, &computedResult);
-  if (result->tag == Iex_RdTmp){
-    cleanupAtEndOfBlock(sbOut, result->Iex.RdTmp.tmp);
-  }
   IRTemp dest = newIRTemp(sbOut->tyenv, Ity_I64);
   IRDirty* dirty =
     unsafeIRDirty_1_N(dest, 1, "executeShadowOp",
@@ -132,6 +272,45 @@ IRExpr* runShadowOp(IRSB* sbOut, IRExpr* guard,
   return IRExpr_RdTmp(dest);
 }
 
+IRExpr* runShadowOp(IRSB* sbOut, IRExpr* guard,
+                    IROp op_code,
+                    Addr curAddr, Addr block_addr,
+                    int nargs, IRExpr** argExprs,
+                    IRExpr* result){
+  if (opInfoTable == NULL){
+    opInfoTable = VG_(HT_construct)("Operation Info Table");
+  }
+  ShadowOpInfoInstance* instance =
+    getSemanticOpInfoInstance(curAddr, block_addr, op_code,
+                              nargs, argExprs);
+  return runShadowOpInstance(sbOut, guard, instance,
+                             nargs, argExprs, result);
+}
+
+// With --sample-rate=N, only one in every N executions of a site
+// gets shadowed. Each site counts down from N-1 to zero, and the
+// execution where the countdown is zero is the sampled one. This is
+// the inline version of sampleSite in shadowop.c, and like it counts
+// the skipped executions, one for each channel, so that num-calls
+// still covers them.
+static IRExpr* runSampleSite(IRSB* sbOut, ShadowOpInfo* info){
+  IRExpr* countdown =
+    runLoad32(sbOut, mkU64((uintptr_t)&(info->sample_countdown)));
+  IRExpr* skip = runBinop(sbOut, Iop_CmpNE32, countdown, mkU32(0));
+  addStoreC(sbOut,
+            runITE(sbOut, skip,
+                   runBinop(sbOut, Iop_Sub32, countdown, mkU32(1)),
+                   mkU32(sample_rate - 1)),
+            &(info->sample_countdown));
+  IRExpr* unsampled =
+    runLoad64(sbOut, mkU64((uintptr_t)&(info->unsampled_calls)));
+  addStoreGC(sbOut, skip,
+             runBinop(sbOut, Iop_Add64, unsampled,
+                      mkU64(numSIMDOperands(info->op_code))),
+             &(info->unsampled_calls));
+  return runUnop(sbOut, Iop_Not1, skip);
+}
+
 void instrumentPossibleNegate(IRSB* sbOut,
                               IRExpr** argExprs, IRTemp dest,
                               Addr curAddr, Addr blockAddr){
@@ -199,7 +378,7 @@ ShadowOpInfoInstance* getSemanticOpInfoInstance(Addr callAddr, Addr block_addr,
     entry->call_addr = callAddr;
     entry->info = callInfo;
     entry->op_code = op_code;
-    VG_(HT_add_node)(mathreplaceOpInfoMap, entry);
+    VG_(HT_add_node)(semanticOpInfoMap, entry);
   }
   ShadowOpInfoInstance* instance = VG_(perm_malloc)(sizeof(ShadowOpInfoInstance),
                                                     vg_alignof(ShadowOpInfoInstance));
@@ -211,5 +390,6 @@ ShadowOpInfoInstance* getSemanticOpInfoInstance(Addr callAddr, Addr block_addr,
     }
   }
   instance->info = entry->info;
+  initShadowOpPlan(&(instance->plan), instance->info);
   return instance;
 }
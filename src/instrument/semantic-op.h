@@ -44,6 +44,17 @@ void instrumentPossibleNegate(IRSB* sbOut,
                               IRExpr** argExprs, IRTemp dest,
                               Addr curAddr, Addr blockAddr);
 
+// With --batch-ops, semantic ops aren't run where they happen, but
+// saved up in a batch, which has to be run with flushOpBatch before
+// anything that might look at their results or arguments (which
+// exprNeedsOpBatch says), or leave the block.
+void flushOpBatch(IRSB* sbOut);
+// Run the batch so far only if the guard is true, as on the way out
+// of a side exit, and keep building it otherwise. Since the guarded
+// run only happens if we're leaving, no op ends up running twice.
+void flushOpBatchG(IRSB* sbOut, IRExpr* guard);
+Bool exprNeedsOpBatch(IRExpr* expr);
+
 IRExpr* runShadowOp(IRSB* sbOut, IRExpr* guard,
                     IROp op_code,
                     Addr curAddr, Addr block_addr,
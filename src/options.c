@@ -88,6 +88,12 @@ Bool generalize_to_constant = True;
 Bool no_exprs = False;
 Bool no_influences = False;
 Bool no_reals = False;
+Bool use_double_double = False;
+Bool adaptive_precision = False;
+Bool lazy_reals = False;
+Bool elide_exact_values = False;
+Bool lazy_exprs = False;
+Bool batch_ops = False;
 Bool use_ranges = True;
 Bool dummy = False;
 
@@ -95,6 +101,11 @@ Int precision = 1000;
 Int max_expr_block_depth = 5;
 double error_threshold = 5.0;
 Int max_influences = 20;
+Int lazy_sample_interval = 32;
+Int sample_rate = 1;
+Int retire_after = 0;
+Int revive_interval = 0;
+Int expr_converge_threshold = 16;
 const char* output_filename = NULL;
 
 // Called to process each command line option.
@@ -148,6 +159,12 @@ Bool hg_process_cmd_line_option(const HChar* arg){
   else if VG_XACT_CLO(arg, "--no-exprs", no_exprs, True) {}
   else if VG_XACT_CLO(arg, "--no-influences", no_influences, True) {}
   else if VG_XACT_CLO(arg, "--no-reals", no_reals, True) {}
+  else if VG_XACT_CLO(arg, "--double-double", use_double_double, True) {}
+  else if VG_XACT_CLO(arg, "--adaptive-precision", adaptive_precision, True) {}
+  else if VG_XACT_CLO(arg, "--lazy-reals", lazy_reals, True) {}
+  else if VG_XACT_CLO(arg, "--elide-exact-values", elide_exact_values, True) {}
+  else if VG_XACT_CLO(arg, "--lazy-exprs", lazy_exprs, True) {}
+  else if VG_XACT_CLO(arg, "--batch-ops", batch_ops, True) {}
   else if VG_XACT_CLO(arg, "--no-ranges", use_ranges, False) {}
   else if VG_XACT_CLO(arg, "--dummy", dummy, True) {}
 
@@ -156,6 +173,11 @@ Bool hg_process_cmd_line_option(const HChar* arg){
   else if VG_BINT_CLO(arg, "--max-expr-block-depth", max_expr_block_depth, 1, 100) {}
   else if VG_DBL_CLO(arg, "--error-threshold", error_threshold) {}
   else if VG_BINT_CLO(arg, "--max-influences", max_influences, 1, 1000) {}
+  else if VG_BINT_CLO(arg, "--lazy-sample-interval", lazy_sample_interval, 1, 1000000) {}
+  else if VG_BINT_CLO(arg, "--sample-rate", sample_rate, 1, 1000000) {}
+  else if VG_BINT_CLO(arg, "--retire-after", retire_after, 0, 1000000000) {}
+  else if VG_BINT_CLO(arg, "--revive-interval", revive_interval, 0, 1000000000) {}
+  else if VG_BINT_CLO(arg, "--expr-converge-threshold", expr_converge_threshold, 0, 1000000) {}
   else if VG_STR_CLO(arg, "--outfile", output_filename) {}
   else return False;
   return True;
@@ -164,12 +186,73 @@ Bool hg_process_cmd_line_option(const HChar* arg){
 void hg_print_usage(void){
   VG_(printf)("    --precision=value    "
               "Sets the mantissa size of the shadow \"real\" values. [1000]\n"
+              "    --double-double    "
+              "Shadow values with double-double arithmetic, only "
+              "switching to --precision bits when cancellation makes "
+              "that unreliable, and switching back once a result fits "
+              "in a double-double again. Values only get --precision "
+              "bits of memory when they switch.\n"
+              "    --adaptive-precision    "
+              "Start every operation at a low shadow precision, and "
+              "raise it, up to --precision, for the ones whose results "
+              "get cancelled away by a later addition, along with the "
+              "operations feeding them. Takes effect from their next "
+              "execution; the execution that found too few bits is "
+              "left out of the error aggregates, and the report gives "
+              "how many were. Needs expressions, so it does nothing with "
+              "--no-exprs, and with --lazy-exprs only adapts operations "
+              "that are tracking theirs.\n"
+              "    --lazy-reals    "
+              "Put off computing the shadow reals of most executions "
+              "until something reads them, and measure their error "
+              "then. Executions whose results are never read aren't "
+              "measured, and are left out of the error aggregates; the "
+              "report gives how many were measured.\n"
+              "    --lazy-sample-interval=value    "
+              "With --lazy-reals, how many executions of an operation "
+              "there are for each one computed right away. [32]\n"
+              "    --elide-exact-values    "
+              "Don't shadow the results of operations that are exact "
+              "on unshadowed arguments. Faster, but those operations "
+              "won't show up in reported expressions. Elided "
+              "executions still count in num-calls, and the report "
+              "gives how many there were.\n"
+              "    --lazy-exprs    "
+              "Only start inferring the expression of an operation "
+              "once it has some error, or one of its values reaches "
+              "a mark. Saves a lot of memory in mostly accurate "
+              "programs.\n"
+              "    --batch-ops    "
+              "Run the shadow operations of a block in batches, with "
+              "one call for each run of operations, instead of one "
+              "call per operation. --stats=yes gives the average "
+              "batch size.\n"
+              "    --sample-rate=value    "
+              "Only shadow one in every this many executions of each "
+              "operation. The rest start over from the client value, "
+              "and reports say how sure they are of the average "
+              "error. Unsampled executions still count in num-calls, "
+              "and the report gives how many there were. [1]\n"
+              "    --retire-after=value    "
+              "Stop shadowing an operation once it's run this many "
+              "times in a row without error, influences, or changes "
+              "to its expression. With --lazy-reals, only executions "
+              "that were computed right away count. 0 never "
+              "retires. [0]\n"
+              "    --revive-interval=value    "
+              "Start shadowing retired operations again after they've "
+              "run this many times in total. 0 never revives. [0]\n"
               "    --error-threshold=bits    "
               "The number of bits of error at which to start "
               "tracking a computation. [5.0]\n"
               "    --max-expr-block-depth=depth    "
               "Sets the maximum depth to which expressions will "
               "maintain proper equivalence information.\n"
+              "    --expr-converge-threshold=value    "
+              "After this many executions of an operation in a row "
+              "don't change its expression, only check that new "
+              "executions still match it, instead of generalizing. "
+              "0 always generalizes. [16]\n"
               "    --outfile=name    "
               "The name of the file to write out. If no name is "
               "specified, will use <executable-name>.gh.\n"
@@ -89,6 +89,12 @@ extern Bool generalize_to_constant;
 extern Bool no_exprs;
 extern Bool no_influences;
 extern Bool no_reals;
+extern Bool use_double_double;
+extern Bool adaptive_precision;
+extern Bool lazy_reals;
+extern Bool elide_exact_values;
+extern Bool lazy_exprs;
+extern Bool batch_ops;
 extern Bool use_ranges;
 extern Bool dummy;
 
@@ -96,6 +102,11 @@ extern Int precision;
 extern Int max_expr_block_depth;
 extern double error_threshold;
 extern Int max_influences;
+extern Int lazy_sample_interval;
+extern Int sample_rate;
+extern Int retire_after;
+extern Int revive_interval;
+extern Int expr_converge_threshold;
 extern const char* output_filename;
 
 #define USE_MPFR
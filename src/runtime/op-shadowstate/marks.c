@@ -35,6 +35,7 @@
 #include "../shadowop/symbolic-op.h"
 #include "pub_tool_libcprint.h"
 #include "pub_tool_libcbase.h"
+#include "pub_tool_mallocfree.h"
 
 VgHashTable* markMap = NULL;
 VgHashTable* intMarkMap = NULL;
@@ -137,6 +138,7 @@ MarkInfo* getMarkInfo(Addr callAddr, int argIdx, int nargs){
       markInfoArray->marks[i].influences = NULL;
       markInfoArray->marks[i].eagg.max_error = -1;
       markInfoArray->marks[i].eagg.total_error = 0;
+      markInfoArray->marks[i].eagg.total_squared_error = 0;
       markInfoArray->marks[i].eagg.num_evals = 0;
     }
     markInfoArray->addr = callAddr;
@@ -163,34 +165,85 @@ int isSubexpr(SymbExpr* needle, SymbExpr* haystack, int depth){
   }
 }
 
+typedef struct _SeenExprEntry {
+  struct _SeenExprEntry* next;
+  UWord expr;
+  // The most depth we had left when we reached this node.
+  int depth;
+} SeenExprEntry;
+
+// Put every node within depth of expr into seen. Expressions share
+// subtrees across sites, so the same node can be reachable along
+// many paths; we only walk under a node again if we got to it with
+// more depth left than before, which keeps this linear in the size
+// of the expression instead of the number of paths through it.
+static void collectSubexprs(VgHashTable* seen, SymbExpr* expr, int depth){
+  if (depth < 1) return;
+  SeenExprEntry* entry = VG_(HT_lookup)(seen, (UWord)expr);
+  if (entry == NULL){
+    entry = VG_(malloc)("seen expr entry", sizeof(SeenExprEntry));
+    entry->expr = (UWord)expr;
+    entry->depth = depth;
+    VG_(HT_add_node)(seen, entry);
+  } else if (entry->depth >= depth){
+    return;
+  } else {
+    entry->depth = depth;
+  }
+  if (expr->type == Node_Leaf) return;
+  for(int i = 0; i < expr->branch.nargs; ++i){
+    collectSubexprs(seen, expr->branch.args[i], depth - 1);
+  }
+}
+
 InfluenceList filterInfluenceSubexprs(InfluenceList influences){
   if (influences == NULL) return NULL;
-  InfluenceList result = mkInfluenceList();
+  if (influences->length == 0) return shareInfluences(influences);
+  Bool* subsumed = VG_(malloc)("subsumed influences",
+                               sizeof(Bool) * influences->length);
   for(int i = 0; i < influences->length; ++i){
-    ShadowOpInfo* influence = influences->data[i];
-    for(int j = 0; j < influences->length; ++j){
-      ShadowOpInfo* otherInfluence = influences->data[j];
-      if (otherInfluence == influence){
-        continue;
-      }
-      if (isSubexpr(influence->expr, otherInfluence->expr,
-                    max_expr_block_depth * 2)){
-        goto dont_keep_influence;
+    subsumed[i] = False;
+  }
+  // Walk each influence's expression once, and drop every other
+  // influence whose expression shows up in it, rather than searching
+  // every expression for every other one.
+  for(int j = 0; j < influences->length; ++j){
+    VgHashTable* seen = VG_(HT_construct)("seen subexprs");
+    collectSubexprs(seen, influenceAt(influences, j)->expr,
+                    max_expr_block_depth * 2);
+    for(int i = 0; i < influences->length; ++i){
+      if (i == j || subsumed[i]) continue;
+      if (VG_(HT_lookup)(seen, (UWord)influenceAt(influences, i)->expr) != NULL){
+        subsumed[i] = True;
       }
     }
-    result->data[result->length++] = influences->data[i];
-  dont_keep_influence:;
+    VG_(HT_destruct)(seen, VG_(free));
+  }
+  UInt* kept = VG_(malloc)("kept influences",
+                           sizeof(UInt) * influences->length);
+  int numKept = 0;
+  for(int i = 0; i < influences->length; ++i){
+    if (!subsumed[i]){
+      kept[numKept++] = influences->ids[i];
+    }
   }
+  InfluenceList result = mkInfluenceList(kept, numKept);
+  VG_(free)(kept);
+  VG_(free)(subsumed);
   return result;
 }
 
 InfluenceList filterUnimprovableInfluences(InfluenceList influences){
   if (influences == NULL) return NULL;
-  InfluenceList result = mkInfluenceList();
+  UInt* kept = VG_(malloc)("kept influences",
+                           sizeof(UInt) * (influences->length + 1));
+  int numKept = 0;
   for(int i = 0; i < influences->length; ++i){
-    if (hasRepeatedVars(influences->data[i]->expr)){
-      result->data[result->length++] = influences->data[i];
+    if (hasRepeatedVars(influenceAt(influences, i)->expr)){
+      kept[numKept++] = influences->ids[i];
     }
   }
+  InfluenceList result = mkInfluenceList(kept, numKept);
+  VG_(free)(kept);
   return result;
 }
@@ -41,7 +41,61 @@
 #include "../shadowop/symbolic-op.h"
 #include "../../helper/runtime-util.h"
 
-#define ENTRY_BUFFER_SIZE 2048000
+// Output is streamed to the file through a buffer this big.
+#define OUTPUT_BUFFER_SIZE 65536
+
+// Everything we print about an influence depends only on the
+// influence itself, and the same influences tend to show up under
+// many marks, so the expensive parts are only worked out once.
+typedef struct _InfluenceOutput {
+  struct _InfluenceOutput* next;
+  UWord opinfo;
+  int numVars;
+  char* exprString;
+  char* varString;
+  RangeRecord* totalRanges;
+  RangeRecord* problematicRanges;
+  double* exampleProblematicArgs;
+} InfluenceOutput;
+static VgHashTable* influenceOutputs = NULL;
+
+static InfluenceOutput* getInfluenceOutput(ShadowOpInfo* opinfo){
+  if (influenceOutputs == NULL){
+    influenceOutputs = VG_(HT_construct)("influence outputs");
+  }
+  InfluenceOutput* entry = VG_(HT_lookup)(influenceOutputs, (UWord)opinfo);
+  if (entry != NULL){
+    return entry;
+  }
+  entry = VG_(malloc)("influence output", sizeof(InfluenceOutput));
+  entry->opinfo = (UWord)opinfo;
+  entry->numVars = 0;
+  entry->exprString = NULL;
+  entry->varString = NULL;
+  entry->totalRanges = NULL;
+  entry->problematicRanges = NULL;
+  entry->exampleProblematicArgs = NULL;
+  if (!no_exprs){
+    if (var_swallow){
+      opinfo->expr = varSwallow(opinfo->expr);
+    }
+    entry->exprString = symbExprToString(opinfo->expr, &(entry->numVars));
+    getRangesAndExample(&(entry->totalRanges),
+                        &(entry->problematicRanges),
+                        &(entry->exampleProblematicArgs),
+                        opinfo->expr, entry->numVars);
+    entry->varString = symbExprVarString(entry->numVars);
+  }
+  VG_(HT_add_node)(influenceOutputs, entry);
+  return entry;
+}
+
+static void finishOutput(BBuf* buf){
+  flushBBuf(buf);
+  VG_(close)(buf->fd);
+  VG_(free)(buf->start);
+  VG_(free)(buf);
+}
 
 void writeOutput(void){
   SysRes fileResult =
@@ -54,14 +108,17 @@ void writeOutput(void){
     return;
   }
   Int fileD = sr_Res(fileResult);
+  BBuf* buf = mkFileBBuf(fileD, OUTPUT_BUFFER_SIZE,
+                         VG_(malloc)("output buffer", OUTPUT_BUFFER_SIZE));
 
   if (VG_(HT_count_nodes)(markMap) == 0 &&
       !haveErroneousIntMarks()){
     if (!output_sexp){
-      char output[] = "No marks found!\n";
-      VG_(write)(fileD, output, sizeof(output));
+      printBBuf(buf, "No marks found!\n");
     }
     VG_(printf)("Didn't find any marks!\n");
+    writeRetiredSites(buf);
+    finishOutput(buf);
     return;
   }
   VG_(HT_ResetIter)(markMap);
@@ -83,9 +140,6 @@ void writeOutput(void){
       }
       fnname = getFnName(markInfo->addr);
 
-      char _buf[ENTRY_BUFFER_SIZE];
-      BBuf* buf = mkBBuf(ENTRY_BUFFER_SIZE, _buf);
-
       if (output_sexp){
         printBBuf(buf, "(output\n");
         printBBuf(buf,
@@ -115,6 +169,8 @@ void writeOutput(void){
                     "    (FPCore %s\n"
                     "     %s))\n",
                     varString, exprString);
+          VG_(free)(exprString);
+          VG_(free)(varString);
         }
         printBBuf(buf,
                   "  (avg-error %f)\n"
@@ -143,6 +199,8 @@ void writeOutput(void){
                     "    (FPCore %s\n"
                     "     %s))\n",
                     varString, exprString);
+          VG_(free)(exprString);
+          VG_(free)(varString);
         }
 
         printBBuf(buf,
@@ -155,20 +213,16 @@ void writeOutput(void){
                   markInfo->eagg.max_error,
                   markInfo->eagg.num_evals);
       }
-      unsigned int entryLen = ENTRY_BUFFER_SIZE - buf->bound;
-      VG_(write)(fileD, _buf, entryLen);
 
       InfluenceList filteredInfluences = filterInfluenceSubexprs(markInfo->influences);
       if (only_improvable){
         filteredInfluences = filterUnimprovableInfluences(filteredInfluences);
       }
-      writeInfluences(fileD, filteredInfluences);
+      writeInfluences(buf, filteredInfluences);
       if (output_sexp){
-        char endparens[] = "  )\n)";
-        VG_(write)(fileD, endparens, sizeof(endparens) - 1);
+        printBBuf(buf, "  )\n)");
       }
-      char newline[] = "\n";
-      VG_(write)(fileD, newline, 1);
+      printBBuf(buf, "\n");
     }
   }
   VG_(HT_ResetIter)(intMarkMap);
@@ -190,9 +244,6 @@ void writeOutput(void){
       objname = "Unknown object";
     }
 
-    char _buf[ENTRY_BUFFER_SIZE];
-    BBuf* buf = mkBBuf(ENTRY_BUFFER_SIZE, _buf);
-
     if (output_sexp){
       printBBuf(buf, "(%s\n", intMarkInfo->markType);
       printBBuf(buf,
@@ -217,6 +268,8 @@ void writeOutput(void){
                     "    (FPCore %s\n"
                     "     %s)\n",
                     varString, exprString);
+          VG_(free)(exprString);
+          VG_(free)(varString);
         }
         printBBuf(buf, "    )\n");
       }
@@ -245,6 +298,8 @@ void writeOutput(void){
                     "    (FPCore %s\n"
                     "     %s)\n",
                     varString, exprString);
+          VG_(free)(exprString);
+          VG_(free)(varString);
         }
       }
 
@@ -258,21 +313,19 @@ void writeOutput(void){
                 intMarkInfo->num_mismatches,
                 intMarkInfo->num_hits);
     }
-    unsigned int entryLen = ENTRY_BUFFER_SIZE - buf->bound;
-    VG_(write)(fileD, _buf, entryLen);
 
     InfluenceList filteredInfluences = filterInfluenceSubexprs(intMarkInfo->influences);
     if (only_improvable){
       filteredInfluences = filterUnimprovableInfluences(filteredInfluences);
     }
-    writeInfluences(fileD, filteredInfluences);
+    writeInfluences(buf, filteredInfluences);
     if (output_sexp){
-      char endparens[] = "  )\n"
-        ")\n\n";
-      VG_(write)(fileD, endparens, sizeof(endparens) - 1);
+      printBBuf(buf, "  )\n"
+                ")\n\n");
     }
   }
-  VG_(close)(fileD);
+  writeRetiredSites(buf);
+  finishOutput(buf);
 }
 
 const char* getOutputFilename(void){
@@ -296,44 +349,31 @@ int haveErroneousIntMarks(void){
   return False;
 }
 
-void writeInfluences(Int fileD, InfluenceList influences){
+void writeInfluences(BBuf* buf, InfluenceList influences){
   const char* src_filename;
   const char* objname;
   unsigned int src_line;
-  char _buf[ENTRY_BUFFER_SIZE];
   if (influences == NULL){
     if (!output_sexp){
-      BBuf* buf = mkBBuf(ENTRY_BUFFER_SIZE, _buf);
       printBBuf(buf,
                 "\n"
                 "No influences found!\n"
                 "\n");
-      unsigned int entryLen = ENTRY_BUFFER_SIZE - buf->bound;
-      VG_(write)(fileD, _buf, entryLen);
     }
   }
   if (output_sexp){
-    char startparen[] = "    (\n";
-    VG_(write)(fileD, startparen, sizeof(startparen) - 1);
+    printBBuf(buf, "    (\n");
   }
   for(int j = 0; influences != NULL && j < influences->length; ++j){
-    ShadowOpInfo* opinfo = influences->data[j];
-
-    int numVars;
-    char* exprString = NULL;
-    char* varString = NULL;
-    RangeRecord* totalRanges = NULL;
-    RangeRecord* problematicRanges = NULL;
-    double* exampleProblematicArgs = NULL;
-    if (!no_exprs){
-      if (var_swallow){
-        opinfo->expr = varSwallow(opinfo->expr);
-      }
-      exprString = symbExprToString(opinfo->expr, &numVars);
-      getRangesAndExample(&totalRanges, &problematicRanges, &exampleProblematicArgs,
-                          opinfo->expr, numVars);
-      varString = symbExprVarString(numVars);
-    }
+    ShadowOpInfo* opinfo = influenceAt(influences, j);
+
+    InfluenceOutput* cached = getInfluenceOutput(opinfo);
+    int numVars = cached->numVars;
+    char* exprString = cached->exprString;
+    char* varString = cached->varString;
+    RangeRecord* totalRanges = cached->totalRanges;
+    RangeRecord* problematicRanges = cached->problematicRanges;
+    double* exampleProblematicArgs = cached->exampleProblematicArgs;
 
     if (!VG_(get_filename_linenum)(opinfo->op_addr, &src_filename,
                                    NULL, &src_line)){
@@ -345,7 +385,6 @@ void writeInfluences(Int fileD, InfluenceList influences){
       objname = "Unknown object";
     }
 
-    BBuf* buf = mkBBuf(ENTRY_BUFFER_SIZE, _buf);
     if (output_sexp){
       printBBuf(buf,
                 "    (");
@@ -412,15 +451,43 @@ void writeInfluences(Int fileD, InfluenceList influences){
                 "     (avg-error %f)\n"
                 "     (max-error %f)\n"
                 "     (avg-local-error %f)\n"
-                "     (max-local-error %f)\n"
-                "     (num-calls %lld))\n",
+                "     (max-local-error %f)\n",
                 global_error.total_error
                 / global_error.num_evals,
                 global_error.max_error,
                 local_error.total_error
                 / global_error.num_evals,
-                local_error.max_error,
-                global_error.num_evals);
+                local_error.max_error);
+      if (adaptive_precision){
+        printBBuf(buf,
+                  "     (precision %d)\n"
+                  "     (imprecise-calls %lld)\n",
+                  opinfo->precision,
+                  opinfo->imprecise_calls);
+      }
+      if (sample_rate > 1){
+        printBBuf(buf,
+                  "     (sample-rate %d)\n"
+                  "     (avg-error-confidence %f)\n"
+                  "     (unsampled-calls %lld)\n",
+                  sample_rate,
+                  averageErrorConfidence(&global_error),
+                  opinfo->unsampled_calls);
+      }
+      if (elide_exact_values){
+        printBBuf(buf,
+                  "     (elided-calls %lld)\n",
+                  opinfo->elided_calls);
+      }
+      if (lazy_reals || adaptive_precision || elide_exact_values ||
+          sample_rate > 1){
+        printBBuf(buf,
+                  "     (measured-calls %lld)\n",
+                  global_error.num_evals);
+      }
+      printBBuf(buf,
+                "     (num-calls %lld))\n",
+                siteNumCalls(opinfo));
     } else {
       if (!no_exprs){
         printBBuf(buf,
@@ -478,24 +545,47 @@ void writeInfluences(Int fileD, InfluenceList influences){
                 "   %f bits average error\n"
                 "   %f bits max error\n"
                 "   %f bits average local error\n"
-                "   %f bits max local error\n"
-                "   Aggregated over %lld instances\n",
+                "   %f bits max local error\n",
                 global_error.total_error
                 / global_error.num_evals,
                 global_error.max_error,
                 local_error.total_error
                 / global_error.num_evals,
-                local_error.max_error,
-                global_error.num_evals);
+                local_error.max_error);
+      if (adaptive_precision){
+        printBBuf(buf,
+                  "   %d bits of shadow precision, %lld executions "
+                  "computed with too few\n",
+                  opinfo->precision, opinfo->imprecise_calls);
+      }
+      if (elide_exact_values){
+        printBBuf(buf,
+                  "   %lld executions exact and left unshadowed\n",
+                  opinfo->elided_calls);
+      }
+      if (sample_rate > 1){
+        printBBuf(buf,
+                  "   Sampled one in %d executions, average error "
+                  "within %f bits with 95%% confidence, %lld "
+                  "executions unshadowed\n",
+                  sample_rate,
+                  averageErrorConfidence(&global_error),
+                  opinfo->unsampled_calls);
+      }
+      if (siteNumCalls(opinfo) != global_error.num_evals){
+        printBBuf(buf,
+                  "   Aggregated over %lld of %lld instances\n",
+                  global_error.num_evals,
+                  siteNumCalls(opinfo));
+      } else {
+        printBBuf(buf,
+                  "   Aggregated over %lld instances\n",
+                  global_error.num_evals);
+      }
     }
-    unsigned int entryLen = ENTRY_BUFFER_SIZE - buf->bound;
-    VG_(free)(exprString);
-    VG_(free)(varString);
-    VG_(write)(fileD, _buf, entryLen);
   }
   if (output_sexp){
-    char endparen[] = "    )\n";
-    VG_(write)(fileD, endparen, sizeof(endparen) - 1);
+    printBBuf(buf, "    )\n");
   }
 }
 
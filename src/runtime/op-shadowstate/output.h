@@ -38,7 +38,7 @@ void writeOutput(void);
 
 const char* getOutputFilename(void);
 int haveErroneousIntMarks(void);
-void writeInfluences(Int fileD, InfluenceList influences);
+void writeInfluences(BBuf* buf, InfluenceList influences);
 void writeRangesAndExample(BBuf* buf, int numVars,
                            RangeRecord* ranges,
                            RangeRecord* problematicRanges,
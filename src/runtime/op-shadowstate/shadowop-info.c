@@ -32,17 +32,21 @@
 #include "pub_tool_debuginfo.h"
 #include "pub_tool_libcprint.h"
 #include "pub_tool_libcbase.h"
+#include "pub_tool_libcproc.h"
 #include "../../helper/ir-info.h"
 #include "../../helper/bbuf.h"
 #include "../../helper/runtime-util.h"
 #include "../shadowop/mathreplace.h"
 
 #include <math.h>
-#include <stdint.h>
 
 VgHashTable* mathreplaceOpInfoMap = NULL;
 VgHashTable* semanticOpInfoMap = NULL;
 
+ShadowOpInfo** opInfosById = NULL;
+static UInt numOpInfos = 0;
+static UInt opInfosCapacity = 0;
+
 void initOpShadowState(void){
   mathreplaceOpInfoMap = VG_(HT_construct)("call map mathreplace");
   semanticOpInfoMap = VG_(HT_construct)("call map semantic op");
@@ -58,8 +62,30 @@ ShadowOpInfo* mkShadowOpInfo(IROp_Extended op_code, OpType type,
   result->op_addr = op_addr;
   result->block_addr = block_addr;
   result->op_type = type;
+  if (numOpInfos == opInfosCapacity){
+    opInfosCapacity = opInfosCapacity == 0 ? 256 : opInfosCapacity * 2;
+    opInfosById = VG_(realloc)("op infos by id", opInfosById,
+                               sizeof(ShadowOpInfo*) * opInfosCapacity);
+  }
+  result->id = numOpInfos;
+  opInfosById[numOpInfos++] = result;
 
   result->expr = NULL;
+  if (adaptive_precision && MIN_SITE_PRECISION < precision){
+    result->precision = MIN_SITE_PRECISION;
+  } else {
+    result->precision = precision;
+  }
+  result->producers_depth = 0;
+  result->producers_precision = 0;
+  result->imprecise_calls = 0;
+  result->lazy_countdown = 0;
+  result->lazy_skipped = 0;
+  result->elided_calls = 0;
+  result->sample_countdown = 0;
+  result->unsampled_calls = 0;
+  result->stable_merges = 0;
+  result->clean_execs = 0;
   if (nargs != numFloatArgs(result)){
     printOpInfo(result);
     VG_(printf)("\n");
@@ -71,12 +97,37 @@ ShadowOpInfo* mkShadowOpInfo(IROp_Extended op_code, OpType type,
   return result;
 }
 
+long long int siteNumCalls(ShadowOpInfo* info){
+  return info->agg.global_error.num_evals
+    + info->lazy_skipped
+    + info->imprecise_calls
+    + info->elided_calls
+    + info->unsampled_calls;
+}
+
 void initializeErrorAggregate(ErrorAggregate* error_agg){
   error_agg->max_error = -1;
   error_agg->total_error = 0;
+  error_agg->total_squared_error = 0;
   error_agg->num_evals = 0;
 }
 
+double averageErrorConfidence(ErrorAggregate* error_agg){
+  long long int n = error_agg->num_evals;
+  // With fewer than two samples there's no spread to go on, but the
+  // average can't be further off than the worst error we saw.
+  if (n < 2){
+    return error_agg->max_error < 0 ? 0 : error_agg->max_error;
+  }
+  double mean = error_agg->total_error / n;
+  double variance =
+    (error_agg->total_squared_error - n * mean * mean) / (n - 1);
+  if (variance < 0){
+    variance = 0;
+  }
+  return 1.96 * sqrt(variance / n);
+}
+
 void initializeAggregate(Aggregate* agg, int nargs){
   initializeErrorAggregate(&(agg->global_error));
   initializeErrorAggregate(&(agg->local_error));
@@ -198,25 +249,171 @@ const char* getFnName(Addr addr){
   return fnname;
 }
 
-int cmpInfo(ShadowOpInfo* info1, ShadowOpInfo* info2){
-  /* if (info1->agg.local_error.max_error > */
-  /*     info2->agg.local_error.max_error){ */
-  /*   return 1; */
-  /* } else if (info1->agg.local_error.max_error < */
-  /*            info2->agg.local_error.max_error){ */
-  /*   return -1; */
-  /* } else if (info1->agg.local_error.total_error / info1->agg.local_error.num_evals > */
-  /*            info2->agg.local_error.total_error / info2->agg.local_error.num_evals){ */
-  /*   return 1; */
-  /* } else if (info1->agg.local_error.total_error / info1->agg.local_error.num_evals > */
-  /*            info2->agg.local_error.total_error / info2->agg.local_error.num_evals){ */
-  /*   return -1; */
-  /* } else */ if ((uintptr_t)info1 > (uintptr_t)info2){
-    return 1;
-  } else if ((uintptr_t)info1 < (uintptr_t)info2){
-    return -1;
+ShadowOpInfo* getOpInfoById(UInt id){
+  tl_assert(id < numOpInfos);
+  return opInfosById[id];
+}
+
+typedef struct _RetiredSite {
+  struct _RetiredSite* next;
+  UWord op_addr;
+  IROp_Extended op_code;
+  ShadowOpInfo* info;
+  long long int clean_execs;
+  // Milliseconds since startup.
+  UInt retired_at;
+  Bool revived;
+  UInt revived_at;
+} RetiredSite;
+
+// The sites that are retired right now, keyed by address.
+static VgHashTable* retiredSites = NULL;
+// Every retirement there's been, in order, for the report.
+static RetiredSite** retirementLog = NULL;
+static Int numRetirements = 0;
+static Int retirementLogCapacity = 0;
+UInt reviveCountdown = 0;
+
+// Translations can't be thrown out from inside a helper, since the
+// block that called it is still running. Instead, the range to throw
+// out next sits in these two, and the start of every block leaves to
+// the scheduler with it when there's one there. The rest wait here.
+Addr nextDiscardAddr = 0;
+ULong nextDiscardLen = 0;
+static Addr* pendingDiscards = NULL;
+static Int numPendingDiscards = 0;
+static Int pendingDiscardsCapacity = 0;
+
+static void queueDiscard(Addr addr){
+  if (nextDiscardLen == 0){
+    nextDiscardAddr = addr;
+    nextDiscardLen = 1;
+    return;
+  }
+  if (numPendingDiscards == pendingDiscardsCapacity){
+    pendingDiscardsCapacity =
+      pendingDiscardsCapacity == 0 ? 16 : pendingDiscardsCapacity * 2;
+    pendingDiscards = VG_(realloc)("pending discards", pendingDiscards,
+                                   sizeof(Addr) * pendingDiscardsCapacity);
+  }
+  pendingDiscards[numPendingDiscards++] = addr;
+}
+
+void advancePendingDiscards(void){
+  if (numPendingDiscards > 0){
+    nextDiscardAddr = pendingDiscards[--numPendingDiscards];
+    nextDiscardLen = 1;
   } else {
-    tl_assert(info1 == info2);
+    nextDiscardAddr = 0;
+    nextDiscardLen = 0;
+  }
+}
+
+static Word cmpRetiredSite(const void* node1, const void* node2){
+  const RetiredSite* site1 = (const RetiredSite*)node1;
+  const RetiredSite* site2 = (const RetiredSite*)node2;
+  if (site1->op_addr == site2->op_addr &&
+      site1->op_code == site2->op_code){
     return 0;
+  } else {
+    return 1;
+  }
+}
+
+Bool isSiteRetired(Addr op_addr, IROp_Extended op_code){
+  if (retiredSites == NULL){
+    return False;
+  }
+  RetiredSite key = {.op_addr = op_addr, .op_code = op_code};
+  return VG_(HT_gen_lookup)(retiredSites, &key, cmpRetiredSite) != NULL;
+}
+
+static void retireSite(ShadowOpInfo* info){
+  if (isSiteRetired(info->op_addr, info->op_code)){
+    return;
+  }
+  if (retiredSites == NULL){
+    retiredSites = VG_(HT_construct)("retired sites");
+  }
+  if (VG_(HT_count_nodes)(retiredSites) == 0){
+    reviveCountdown = revive_interval;
+  }
+  RetiredSite* site = VG_(malloc)("retired site", sizeof(RetiredSite));
+  site->op_addr = info->op_addr;
+  site->op_code = info->op_code;
+  site->info = info;
+  site->clean_execs = info->clean_execs;
+  site->retired_at = VG_(read_millisecond_timer)();
+  site->revived = False;
+  site->revived_at = 0;
+  VG_(HT_add_node)(retiredSites, site);
+
+  if (numRetirements == retirementLogCapacity){
+    retirementLogCapacity =
+      retirementLogCapacity == 0 ? 16 : retirementLogCapacity * 2;
+    retirementLog = VG_(realloc)("retirement log", retirementLog,
+                                 sizeof(RetiredSite*) * retirementLogCapacity);
+  }
+  retirementLog[numRetirements++] = site;
+
+  // Blocks instrumented from here on see the site as retired, so
+  // throwing out every translation with the site in it is enough to
+  // stop shadowing it. That happens the next time a block starts, so
+  // the block we're in right now finishes on the old code.
+  queueDiscard(info->op_addr);
+}
+
+void updateRetirement(ShadowOpInfo* info, Bool clean){
+  if (!clean){
+    info->clean_execs = 0;
+    return;
+  }
+  info->clean_execs++;
+  if (info->clean_execs >= retire_after){
+    retireSite(info);
+  }
+}
+
+void reviveRetiredSites(void){
+  UInt numSites;
+  VgHashNode** sites = VG_(HT_to_array)(retiredSites, &numSites);
+  UInt now = VG_(read_millisecond_timer)();
+  for(UInt i = 0; i < numSites; ++i){
+    RetiredSite* site = (RetiredSite*)sites[i];
+    VG_(HT_gen_remove)(retiredSites, site, cmpRetiredSite);
+    site->revived = True;
+    site->revived_at = now;
+    // Make it earn its retirement all over again.
+    site->info->clean_execs = 0;
+    queueDiscard(site->op_addr);
+  }
+  VG_(free)(sites);
+}
+
+void writeRetiredSites(BBuf* buf){
+  for(int i = 0; i < numRetirements; ++i){
+    RetiredSite* site = retirementLog[i];
+    char* addrString = getAddrString(site->op_addr);
+    if (output_sexp){
+      printBBuf(buf,
+                "(retired-site \"%s\"\n"
+                "  (clean-calls %lld)\n"
+                "  (retired-at-ms %u)",
+                addrString, site->clean_execs, site->retired_at);
+      if (site->revived){
+        printBBuf(buf, "\n  (revived-at-ms %u)", site->revived_at);
+      }
+      printBBuf(buf, ")\n\n");
+    } else {
+      printBBuf(buf,
+                "Retired %s after %lld executions without error, "
+                "%u ms in",
+                addrString, site->clean_execs, site->retired_at);
+      if (site->revived){
+        printBBuf(buf, ", revived %u ms in", site->revived_at);
+      }
+      printBBuf(buf, "\n");
+    }
+    VG_(free)(addrString);
   }
 }
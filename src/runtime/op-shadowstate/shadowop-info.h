@@ -35,6 +35,7 @@
 #include "pub_tool_hashtable.h"
 
 #include "../../helper/ir-info.h"
+#include "../../helper/bbuf.h"
 
 #include "../value-shadowstate/exprs.hh"
 #include "../value-shadowstate/range.h"
@@ -49,6 +50,9 @@ extern VgHashTable* intMarkMap;
 typedef struct _ErrorAggregate {
   double max_error;
   double total_error;
+  // For working out how far off the average might be when we're only
+  // seeing a sample of the executions.
+  double total_squared_error;
   long long int num_evals;
 } ErrorAggregate;
 
@@ -62,6 +66,11 @@ typedef struct _Aggregate {
   InputsRecord inputs;
 } Aggregate;
 
+// With --adaptive-precision, sites start out computing their shadow
+// results with this many bits, and only go up from there when
+// something downstream needs more.
+#define MIN_SITE_PRECISION 128
+
 typedef struct _ShadowOpInfo {
   // These two are mutually exclusive.
   IROp_Extended op_code;
@@ -69,13 +78,72 @@ typedef struct _ShadowOpInfo {
 
   Addr op_addr;
   Addr block_addr;
+  // Sites are numbered densely in the order they're made, so that
+  // sets of them can be kept as sorted arrays of ids.
+  UInt id;
   Aggregate agg;
   SymbExpr* expr;
+  // The number of bits this site's shadow results are computed with.
+  int precision;
+  // With --adaptive-precision, how many levels of sites behind this
+  // one have been raised to at least how many bits.
+  int producers_depth;
+  int producers_precision;
+  // With --adaptive-precision, how many executions were left out of
+  // the site's error aggregates because they were computed from
+  // arguments without enough bits.
+  long long int imprecise_calls;
+  // With --lazy-reals, how many more executions of this site to
+  // defer before computing one right away again.
+  int lazy_countdown;
+  // With --lazy-reals, how many executions are left out of the site's
+  // error aggregates because nothing has read their results yet.
+  long long int lazy_skipped;
+  // With --elide-exact-values, how many executions were left
+  // unshadowed because they were exact on unshadowed arguments.
+  long long int elided_calls;
+  // With --sample-rate, how many more executions of this site to
+  // leave unshadowed before shadowing one again.
+  int sample_countdown;
+  // With --sample-rate, how many executions were left unshadowed
+  // because they weren't sampled.
+  long long int unsampled_calls;
+  // How many executions in a row have left this site's expression
+  // unchanged. Once this reaches --expr-converge-threshold, new
+  // executions are only checked against the expression.
+  int stable_merges;
+  // With --retire-after, how many executions in a row this site has
+  // gone without error or influences.
+  long long int clean_execs;
 } ShadowOpInfo;
 
+typedef struct _ShadowValue ShadowValue;
+struct _RealStruct;
+// Computes the real result of an operation from the reals of its
+// arguments.
+typedef void (*RealOpKernel)(struct _RealStruct* result, ShadowValue** args);
+
+// Everything executeShadowOp needs to know about an operation that
+// only depends on its op code, worked out when the block is
+// instrumented instead of on every execution.
+typedef struct _ShadowOpPlan {
+  FloatBlocks numBlocks;
+  FloatBlocks numArgBlocks;
+  int nargs;
+  int numChannels;
+  int numOperandBlocks;
+  ValueType argPrecision;
+  // The precision of the client arguments on each channel.
+  ValueType channelArgPrecisions[MAX_TEMP_BLOCKS];
+  // Multiplications by zero skip the real computation entirely.
+  Bool isMul;
+  RealOpKernel kernel;
+} ShadowOpPlan;
+
 typedef struct _ShadowOpInfoInstance {
   ShadowOpInfo* info;
   int argTemps[4];
+  ShadowOpPlan plan;
 } ShadowOpInfoInstance;
 
 typedef struct _ShadowCmpInfo {
@@ -104,8 +172,14 @@ ShadowOpInfo* mkShadowOpInfo(IROp_Extended op_code, OpType type,
                              int nargs);
 void initializeAggregate(Aggregate* agg, int nargs);
 void initializeErrorAggregate(ErrorAggregate* error_agg);
+// The half-width of a 95% confidence interval around the average
+// error of an aggregate, treating the executions it saw as a random
+// sample of all of them.
+double averageErrorConfidence(ErrorAggregate* error_agg);
+// How many times a site has run, counting the executions that were
+// left out of its error aggregates.
+long long int siteNumCalls(ShadowOpInfo* info);
 
-typedef struct _ShadowValue ShadowValue;
 void updateInputRecords(InputsRecord* record, ShadowValue** args, int nargs);
 
 void printOpInfo(ShadowOpInfo* opinfo);
@@ -115,6 +189,26 @@ char* getAddrString(Addr addr);
 int numFloatArgs(ShadowOpInfo* opinfo);
 const char* getFnName(Addr addr);
 
-int cmpInfo(ShadowOpInfo* info1, ShadowOpInfo* info2);
+// Every site ever made, indexed by id.
+extern ShadowOpInfo** opInfosById;
+ShadowOpInfo* getOpInfoById(UInt id);
+
+// With --retire-after, once a site has gone that many executions
+// without any error or influences, and its expression has stopped
+// changing, it gets retired: its translations are thrown out, and
+// from then on it's instrumented as a plain client operation.
+void updateRetirement(ShadowOpInfo* info, Bool clean);
+Bool isSiteRetired(Addr op_addr, IROp_Extended op_code);
+// With --revive-interval, instrumented code for retired sites counts
+// this down, and calls reviveRetiredSites when it hits zero.
+extern UInt reviveCountdown;
+void reviveRetiredSites(void);
+// Retiring and reviving sites queue up translations to throw out. The
+// next one is in these two (with a zero length when there isn't one),
+// and advancePendingDiscards moves on to the one after it.
+extern Addr nextDiscardAddr;
+extern ULong nextDiscardLen;
+void advancePendingDiscards(void);
+void writeRetiredSites(BBuf* buf);
 
 #endif
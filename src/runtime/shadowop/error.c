@@ -46,6 +46,7 @@ double updateError(ErrorAggregate* eagg,
     eagg->max_error = bitsError;
   }
   eagg->total_error += bitsError;
+  eagg->total_squared_error += bitsError * bitsError;
   eagg->num_evals += 1;
 
 
@@ -40,6 +40,9 @@ VG_REGPARM(1) void checkCompare(ShadowCmpInfo* info){
   }
   int correctOutput;
   if (numSIMDOperands(info->op_code) == 1){
+    for(int i = 0; i < 2; ++i){
+      getArgValue(args[i], i, info->op_code, 0);
+    }
     if (double_comparisons){
       double correctFst = getDouble(args[0]->values[0]->real);
       double correctSnd = getDouble(args[1]->values[0]->real);
@@ -208,6 +211,7 @@ VG_REGPARM(1) void checkCompare(ShadowCmpInfo* info){
 VG_REGPARM(3) void checkConvert(IROp_Extended op, IRTemp tmp,
                                 Addr curAddr){
   ShadowTemp* arg = getArg(0, op, tmp);
+  getArgValue(arg, 0, op, 0);
   int correctResult = (int)getDouble(arg->values[0]->real);
   int computedValue =
     *((int*)&computedResult.f[0]);
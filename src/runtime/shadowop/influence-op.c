@@ -94,12 +94,12 @@ void trackOpAsInfluence(ShadowOpInfo* info, ShadowValue* value){
   value->influences = lst;
 }
 InfluenceList cloneInfluences(InfluenceList influences){
-  return mergeInfluences(influences, NULL, NULL);
+  return shareInfluences(influences);
 }
 
 void forceTrack(Addr varAddr){
   ShadowValue* val = getMemShadow(varAddr);
-  ShadowOpInfo* info = val->expr->branch.op;
+  ShadowOpInfo* info = concExprOp(val->expr);
   VG_(printf)("Tracking %p\n", val);
   trackOpAsInfluence(info, val);
 }
@@ -81,24 +81,27 @@ void performWrappedOp(OpType type, double* resLoc, double* args){
       VG_(printf)("\n");
     }
   }
-  ShadowValue* shadowResult = runWrappedShadowOp(type, shadowArgs);
+  Addr callAddr = getCallAddr();
+  ShadowOpInfo* info = getWrappedOpInfo(callAddr, type, nargs);
+  ShadowValue* shadowResult =
+    runWrappedShadowOp(type, info->precision, shadowArgs);
   *resLoc = runEmulatedWrappedOp(type, args);
   removeMemShadow((UWord)(uintptr_t)resLoc);
   addMemShadow((UWord)(uintptr_t)resLoc, shadowResult);
 
-  Addr callAddr = getCallAddr();
-  ShadowOpInfo* info = getWrappedOpInfo(callAddr, type, nargs);
   if (print_errors_long || print_errors){
     printOpInfo(info);
     VG_(printf)(":\n");
   }
   double bitsGlobalError =
     updateError(&(info->agg.global_error), shadowResult->real, *resLoc);
-  execSymbolicOp(info, &(shadowResult->expr),
-                 *resLoc, shadowArgs,
-                 bitsGlobalError > error_threshold);
   double bitsLocalError =
     execLocalOp(info, shadowResult->real, shadowResult, shadowArgs);
+  execSymbolicOp(info, &(shadowResult->expr),
+                 *resLoc, shadowArgs,
+                 bitsGlobalError > error_threshold,
+                 bitsGlobalError > error_threshold ||
+                 bitsLocalError >= error_threshold);
   execInfluencesOp(info, &(shadowResult->influences), shadowArgs,
                    bitsLocalError >= error_threshold);
   if (print_influences){
@@ -202,9 +205,11 @@ const char* getWrappedName(OpType type){
   }
 }
 
-ShadowValue* runWrappedShadowOp(OpType type, ShadowValue** shadowArgs){
+ShadowValue* runWrappedShadowOp(OpType type, int resultPrecision,
+                                 ShadowValue** shadowArgs){
   ShadowValue* result = mkShadowValueBare(getWrappedPrecision(type));
   if (no_reals) return result;
+  setRealPrecision(result->real, resultPrecision);
   switch(type){
   case OP_CDIVR:
   case OP_CDIVI:
@@ -215,17 +220,17 @@ ShadowValue* runWrappedShadowOp(OpType type, ShadowValue** shadowArgs){
       mpc_init2(arg1, precision);
       mpc_init2(arg2, precision);
       mpc_init2(resultComplex, precision);
-      mpc_set_fr_fr(arg1, shadowArgs[0]->real->RVAL, shadowArgs[1]->real->RVAL,
+      mpc_set_fr_fr(arg1, RARG(shadowArgs[0]->real), RARG(shadowArgs[1]->real),
                     MPC_RNDNN);
-      mpc_set_fr_fr(arg2, shadowArgs[2]->real->RVAL, shadowArgs[3]->real->RVAL,
+      mpc_set_fr_fr(arg2, RARG(shadowArgs[2]->real), RARG(shadowArgs[3]->real),
                     MPC_RNDNN);
       mpc_div(resultComplex, arg1, arg2, MPC_RNDNN);
       switch(type){
       case OP_CDIVR:
-        mpc_real(result->real->RVAL, resultComplex, MPFR_RNDN);
+        mpc_real(RRES(result->real), resultComplex, MPFR_RNDN);
         break;
       case OP_CDIVI:
-        mpc_imag(result->real->RVAL, resultComplex, MPFR_RNDN);
+        mpc_imag(RRES(result->real), resultComplex, MPFR_RNDN);
         break;
       default:
         tl_assert(0);
@@ -245,15 +250,15 @@ ShadowValue* runWrappedShadowOp(OpType type, ShadowValue** shadowArgs){
       mpc_t resultComplex;
       mpc_init2(arg, precision);
       mpc_init2(resultComplex, precision);
-      mpc_set_fr_fr(arg, shadowArgs[0]->real->RVAL, shadowArgs[1]->real->RVAL,
+      mpc_set_fr_fr(arg, RARG(shadowArgs[0]->real), RARG(shadowArgs[1]->real),
                     MPC_RNDNN);
       mpc_func(resultComplex, arg, MPC_RNDNN);
       switch(type){
       case UNARY_COMPLEX_OPS_CASES_R:
-        mpc_real(result->real->RVAL, resultComplex, MPFR_RNDN);
+        mpc_real(RRES(result->real), resultComplex, MPFR_RNDN);
         break;
       case UNARY_COMPLEX_OPS_CASES_I:
-        mpc_imag(result->real->RVAL, resultComplex, MPFR_RNDN);
+        mpc_imag(RRES(result->real), resultComplex, MPFR_RNDN);
         break;
       default:
         tl_assert(0);
@@ -274,17 +279,17 @@ ShadowValue* runWrappedShadowOp(OpType type, ShadowValue** shadowArgs){
       mpc_init2(arg1, precision);
       mpc_init2(arg2, precision);
       mpc_init2(resultComplex, precision);
-      mpc_set_fr_fr(arg1, shadowArgs[0]->real->RVAL, shadowArgs[1]->real->RVAL,
+      mpc_set_fr_fr(arg1, RARG(shadowArgs[0]->real), RARG(shadowArgs[1]->real),
                     MPC_RNDNN);
-      mpc_set_fr_fr(arg2, shadowArgs[2]->real->RVAL, shadowArgs[3]->real->RVAL,
+      mpc_set_fr_fr(arg2, RARG(shadowArgs[2]->real), RARG(shadowArgs[3]->real),
                     MPC_RNDNN);
       mpc_func(resultComplex, arg1, arg2, MPC_RNDNN);
       switch(type){
       case BINARY_COMPLEX_OPS_CASES_R:
-        mpc_real(result->real->RVAL, resultComplex, MPFR_RNDN);
+        mpc_real(RRES(result->real), resultComplex, MPFR_RNDN);
         break;
       case BINARY_COMPLEX_OPS_CASES_I:
-        mpc_imag(result->real->RVAL, resultComplex, MPFR_RNDN);
+        mpc_imag(RRES(result->real), resultComplex, MPFR_RNDN);
         break;
       default:
         tl_assert(0);
@@ -308,19 +313,19 @@ ShadowValue* runWrappedShadowOp(OpType type, ShadowValue** shadowArgs){
       mpc_init2(arg2, precision);
       mpc_init2(arg3, precision);
       mpc_init2(resultComplex, precision);
-      mpc_set_fr_fr(arg1, shadowArgs[0]->real->RVAL, shadowArgs[1]->real->RVAL,
+      mpc_set_fr_fr(arg1, RARG(shadowArgs[0]->real), RARG(shadowArgs[1]->real),
                     MPC_RNDNN);
-      mpc_set_fr_fr(arg2, shadowArgs[2]->real->RVAL, shadowArgs[3]->real->RVAL,
+      mpc_set_fr_fr(arg2, RARG(shadowArgs[2]->real), RARG(shadowArgs[3]->real),
                     MPC_RNDNN);
-      mpc_set_fr_fr(arg3, shadowArgs[4]->real->RVAL, shadowArgs[5]->real->RVAL,
+      mpc_set_fr_fr(arg3, RARG(shadowArgs[4]->real), RARG(shadowArgs[5]->real),
                     MPC_RNDNN);
       mpc_func(resultComplex, arg1, arg2, arg3, MPC_RNDNN);
       switch(type){
       case TERNARY_COMPLEX_OPS_CASES_R:
-        mpc_real(result->real->RVAL, resultComplex, MPFR_RNDN);
+        mpc_real(RRES(result->real), resultComplex, MPFR_RNDN);
         break;
       case TERNARY_COMPLEX_OPS_CASES_I:
-        mpc_imag(result->real->RVAL, resultComplex, MPFR_RNDN);
+        mpc_imag(RRES(result->real), resultComplex, MPFR_RNDN);
         break;
       default:
         tl_assert(0);
@@ -338,8 +343,8 @@ ShadowValue* runWrappedShadowOp(OpType type, ShadowValue** shadowArgs){
 
       GET_UNARY_OPS_ROUND_F(mpfr_func, type);
 
-      mpfr_func(result->real->RVAL,
-                shadowArgs[0]->real->RVAL, MPFR_RNDN);
+      mpfr_func(RRES(result->real),
+                RARG(shadowArgs[0]->real), MPFR_RNDN);
     }
     break;
   case UNARY_OPS_NOROUND_CASES:
@@ -347,7 +352,7 @@ ShadowValue* runWrappedShadowOp(OpType type, ShadowValue** shadowArgs){
       int (*mpfr_func)(mpfr_t, mpfr_srcptr);
       GET_UNARY_OPS_NOROUND_F(mpfr_func, type);
 
-      mpfr_func(result->real->RVAL, shadowArgs[0]->real->RVAL);
+      mpfr_func(RRES(result->real), RARG(shadowArgs[0]->real));
     }
     break;
   case BINARY_OPS_CASES:
@@ -355,9 +360,9 @@ ShadowValue* runWrappedShadowOp(OpType type, ShadowValue** shadowArgs){
       int (*mpfr_func)(mpfr_t, mpfr_srcptr, mpfr_srcptr, mpfr_rnd_t);
       GET_BINARY_OPS_F(mpfr_func, type);
 
-      mpfr_func(result->real->RVAL,
-                shadowArgs[0]->real->RVAL,
-                shadowArgs[1]->real->RVAL, MPFR_RNDN);
+      mpfr_func(RRES(result->real),
+                RARG(shadowArgs[0]->real),
+                RARG(shadowArgs[1]->real), MPFR_RNDN);
     }
     break;
   case TERNARY_OPS_CASES:
@@ -365,10 +370,10 @@ ShadowValue* runWrappedShadowOp(OpType type, ShadowValue** shadowArgs){
       int (*mpfr_func)(mpfr_t, mpfr_srcptr, mpfr_srcptr, mpfr_srcptr, mpfr_rnd_t);
       GET_TERNARY_OPS_F(mpfr_func, type);
 
-      mpfr_func(result->real->RVAL,
-                shadowArgs[0]->real->RVAL,
-                shadowArgs[1]->real->RVAL,
-                shadowArgs[2]->real->RVAL,
+      mpfr_func(RRES(result->real),
+                RARG(shadowArgs[0]->real),
+                RARG(shadowArgs[1]->real),
+                RARG(shadowArgs[2]->real),
                 MPFR_RNDN);
     }
     break;
@@ -376,6 +381,7 @@ ShadowValue* runWrappedShadowOp(OpType type, ShadowValue** shadowArgs){
     tl_assert(0);
     return NULL;
   }
+  settleRealResult(result->real, shadowArgs, getWrappedNumArgs(type));
   return result;
 }
 
@@ -41,7 +41,8 @@ ShadowOpInfo* getWrappedOpInfo(Addr callAddr, OpType opType, int nargs);
 int getWrappedNumArgs(OpType type);
 ValueType getWrappedPrecision(OpType type);
 const char* getWrappedName(OpType type);
-ShadowValue* runWrappedShadowOp(OpType type, ShadowValue** shadowArgs);
+ShadowValue* runWrappedShadowOp(OpType type, int resultPrecision,
+                                 ShadowValue** shadowArgs);
 double runEmulatedWrappedOp(OpType type, double* args);
 Word cmp_op_entry_by_type(const void* node1, const void* node2);
 
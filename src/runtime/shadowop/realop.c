@@ -32,32 +32,686 @@
 #include "pub_tool_libcassert.h"
 #include "pub_tool_libcprint.h"
 #include "../../helper/ir-info.h"
+#include "../value-shadowstate/exprs.h"
+#include "../value-shadowstate/value-shadowstate.h"
+#include "shadowop.h"
+#include "../../helper/stack.h"
+#include "pub_tool_mallocfree.h"
+
+static void execRealOpHighPrecision(IROp op_code, RealOpKernel kernel,
+                                    Real* result, ShadowValue** args);
+#ifdef USE_MPFR
+typedef enum {
+  DD_Done,
+  DD_Escalate,
+  DD_Unsupported,
+} DDOpResult;
+static DDOpResult execRealOpDD(IROp op_code, Real result,
+                               ShadowValue** args, int nargs);
+#endif
 
 void execRealOp(IROp op_code, Real* result, ShadowValue** args){
+  execRealOpKernel(op_code, getRealOpKernel(op_code),
+                   getNativeNumFloatArgs(op_code), result, args);
+}
+void execRealOpKernel(IROp op_code, RealOpKernel kernel, int nargs,
+                      Real* result, ShadowValue** args){
   if (no_reals){
     return;
   }
+  for(int i = 0; i < nargs; ++i){
+    forceReal(args[i]->real);
+  }
+  #ifdef USE_MPFR
+  if (use_double_double){
+    switch(execRealOpDD(op_code, *result, args, nargs)){
+    case DD_Done:
+      return;
+    case DD_Escalate:
+      execRealOpHighPrecision(op_code, kernel, result, args);
+      // Escalation isn't for good: once cancellation has been dealt
+      // with, the result often fits back in a double-double.
+      demoteRealIfExact(*result);
+      return;
+    case DD_Unsupported:
+      execRealOpHighPrecision(op_code, kernel, result, args);
+      settleRealResult(*result, args, nargs);
+      return;
+    }
+  }
+  #endif
+  execRealOpHighPrecision(op_code, kernel, result, args);
+}
+
+// A deferred operation holds on to its arguments until it's run, so
+// a long enough chain of pending reals would keep a lot of values
+// alive, and take a lot of stack to materialize. Past this depth, we
+// just run the operation right away.
+#define MAX_PENDING_DEPTH 8
+
+typedef struct _PendingRealOp {
+  struct _PendingRealOp* next;
+  ShadowOpInfo* opinfo;
+  // The value this is the real of. It owns us, so it doesn't need a
+  // reference.
+  ShadowValue* value;
+  int nargs;
+  int depth;
+  ShadowValue* args[4];
+  double clientArgs[4];
+  double clientResult;
+} PendingRealOp;
+
+static Stack* freedPendingOps = NULL;
+
+void deferRealOp(ShadowOpInfo* opinfo, ShadowValue* result,
+                 ShadowValue** args, int nargs,
+                 double* clientArgs, double clientResult){
+  int depth = 0;
+  for(int i = 0; i < nargs; ++i){
+    PendingRealOp* argOp = args[i]->real->pending;
+    if (argOp != NULL && argOp->depth > depth){
+      depth = argOp->depth;
+    }
+  }
+  if (depth >= MAX_PENDING_DEPTH){
+    execRealOp(opinfo->op_code, &(result->real), args);
+    return;
+  }
+  if (freedPendingOps == NULL){
+    freedPendingOps = mkStack();
+  }
+  PendingRealOp* op;
+  if (stack_empty(freedPendingOps)){
+    op = VG_(malloc)("pending real op", sizeof(PendingRealOp));
+  } else {
+    op = (void*)stack_pop(freedPendingOps);
+  }
+  op->opinfo = opinfo;
+  op->value = result;
+  op->nargs = nargs;
+  op->depth = depth + 1;
+  for(int i = 0; i < nargs; ++i){
+    op->args[i] = args[i];
+    op->clientArgs[i] = clientArgs[i];
+    ownShadowValue(args[i]);
+  }
+  op->clientResult = clientResult;
+  result->real->pending = op;
+}
+static void releasePendingOp(PendingRealOp* op){
+  for(int i = 0; i < op->nargs; ++i){
+    disownShadowValue(op->args[i]);
+  }
+  stack_push(freedPendingOps, (void*)op);
+}
+void materializeReal(Real real){
+  PendingRealOp* op = real->pending;
+  real->pending = NULL;
+  // This forces the arguments first, which can't go more than
+  // MAX_PENDING_DEPTH deep.
+  execRealOp(op->opinfo->op_code, &real, op->args);
+  measureDeferredOp(op->opinfo, op->value, op->args,
+                    op->clientArgs, op->clientResult);
+  releasePendingOp(op);
+}
+void dropPendingReal(Real real){
+  PendingRealOp* op = real->pending;
+  real->pending = NULL;
+  releasePendingOp(op);
+}
+
+#ifdef USE_MPFR
+static inline Bool ddIsDouble(const DoubleDouble* dd, double value){
+  return dd->hi == value && dd->lo == 0.0;
+}
+#endif
+// Whether the result of an operation on exact arguments, computed in
+// the reals, is exactly the double the client got. The error-free
+// transformations behind double-double arithmetic make this cheap to
+// check for the basic operations, without touching mpfr; for
+// anything else we just say no.
+Bool realOpIsExact(IROp op_code, double* args, double result){
+  #ifdef USE_MPFR
+  int nargs = getNativeNumFloatArgs(op_code);
+  DoubleDouble dargs[3];
+  for(int i = 0; i < nargs && i < 3; ++i){
+    dargs[i] = (DoubleDouble){args[i], 0.0, DD_EXACT_BITS};
+    if (!ddInSafeRange(&(dargs[i]))){
+      return False;
+    }
+  }
+  DoubleDouble res = {result, 0.0, DD_EXACT_BITS};
+  if (!ddInSafeRange(&res)){
+    return False;
+  }
+  DoubleDouble check;
+  switch((int)op_code){
+  case Iop_Abs32Fx4:
+  case Iop_Abs32Fx2:
+  case Iop_Abs64Fx2:
+  case Iop_AbsF32:
+  case Iop_AbsF64:
+  case Iop_Neg32Fx4:
+  case IEop_Neg32F0x4:
+  case Iop_Neg32Fx2:
+  case Iop_Neg64Fx2:
+  case IEop_Neg64F0x2:
+  case Iop_NegF32:
+  case Iop_NegF64:
+  case Iop_Max64F0x2:
+  case Iop_Max64Fx2:
+  case Iop_Max32F0x4:
+  case Iop_Max32Fx4:
+  case Iop_Max32Fx2:
+  case Iop_Min64F0x2:
+  case Iop_Min64Fx2:
+  case Iop_Min32F0x4:
+  case Iop_Min32Fx4:
+  case Iop_Min32Fx2:
+    return True;
+  case Iop_Add64Fx4:
+  case Iop_Add64Fx2:
+  case Iop_Add64F0x2:
+  case Iop_Add32F0x4:
+  case Iop_Add32Fx2:
+  case Iop_Add32Fx4:
+  case Iop_Add32Fx8:
+  case Iop_AddF64:
+  case Iop_AddF32:
+  case Iop_AddF64r32:
+    ddAdd(&check, &(dargs[0]), &(dargs[1]));
+    return ddIsDouble(&check, result);
+  case Iop_Sub64F0x2:
+  case Iop_Sub32F0x4:
+  case Iop_Sub32Fx2:
+  case Iop_Sub32Fx8:
+  case Iop_Sub64Fx4:
+  case Iop_Sub32Fx4:
+  case Iop_Sub64Fx2:
+  case Iop_SubF32:
+  case Iop_SubF64:
+  case Iop_SubF64r32:
+    ddSub(&check, &(dargs[0]), &(dargs[1]));
+    return ddIsDouble(&check, result);
+  case Iop_Mul32F0x4:
+  case Iop_Mul64F0x2:
+  case Iop_Mul32Fx8:
+  case Iop_Mul64Fx4:
+  case Iop_Mul32Fx4:
+  case Iop_Mul64Fx2:
+  case Iop_MulF64:
+  case Iop_MulF32:
+  case Iop_MulF64r32:
+    // A zero product of nonzero arguments underflowed.
+    if (result == 0.0 && args[0] != 0.0 && args[1] != 0.0){
+      return False;
+    }
+    ddMul(&check, &(dargs[0]), &(dargs[1]));
+    return ddIsDouble(&check, result);
+  // The quotient is exact when multiplying it back gets exactly the
+  // dividend, and the same goes for square roots.
+  case Iop_Div32F0x4:
+  case Iop_Div64F0x2:
+  case Iop_Div32Fx8:
+  case Iop_Div64Fx4:
+  case Iop_Div32Fx4:
+  case Iop_DivF64:
+  case Iop_DivF32:
+  case Iop_DivF64r32:
+  case Iop_Div64Fx2:
+    if (args[1] == 0.0){
+      return False;
+    }
+    ddMul(&check, &res, &(dargs[1]));
+    return ddIsDouble(&check, args[0]);
+  case Iop_SqrtF64:
+  case Iop_SqrtF32:
+  case Iop_Sqrt32F0x4:
+  case Iop_Sqrt64F0x2:
+  case Iop_Sqrt64Fx2:
+    if (result < 0){
+      return False;
+    }
+    ddMul(&check, &res, &res);
+    return ddIsDouble(&check, args[0]);
+  default:
+    return False;
+  }
+  #else
+  return False;
+  #endif
+}
+
+#ifdef USE_MPFR
+// Results of operations we can only do in mpfr, like the
+// transcendental ones, can go back to being double-doubles as long
+// as none of their arguments were escalated. They're computed at
+// full precision from the arguments, so they're about as good as the
+// worst argument.
+void settleRealResult(Real result, ShadowValue** args, int nargs){
+  if (!use_double_double){
+    return;
+  }
+  int bits = DD_PRECISION_BITS;
+  for(int i = 0; i < nargs; ++i){
+    if (args[i]->real->escalated){
+      return;
+    }
+    if (args[i]->real->dd.bits - 1 < bits){
+      bits = args[i]->real->dd.bits - 1;
+    }
+  }
+  // Infinities, NaNs, and values near the ends of the range stay in
+  // mpfr.
+  DoubleDouble rounded = {mpfr_get_d(result->mpfr_val, MPFR_RNDN), 0.0, bits};
+  if (bits < DD_MIN_BITS || !ddInSafeRange(&rounded)){
+    return;
+  }
+  demoteReal(result, bits);
+}
+
+#endif
+
+// How many bits an argument to an addition needs to have left after
+// cancellation for us to trust the result: a double's worth, plus
+// some slack.
+#define SITE_NEEDED_BITS 64
+
+static Bool isAdditiveOp(IROp_Extended op_code){
+  switch((int)op_code){
+  case Iop_Add64Fx4:
+  case Iop_Add64Fx2:
+  case Iop_Add64F0x2:
+  case Iop_Add32F0x4:
+  case Iop_Add32Fx2:
+  case Iop_Add32Fx4:
+  case Iop_Add32Fx8:
+  case Iop_AddF128:
+  case Iop_AddF64:
+  case Iop_AddF32:
+  case Iop_AddF64r32:
+  case Iop_Sub64F0x2:
+  case Iop_Sub32F0x4:
+  case Iop_Sub32Fx2:
+  case Iop_Sub32Fx8:
+  case Iop_Sub64Fx4:
+  case Iop_Sub32Fx4:
+  case Iop_Sub64Fx2:
+  case Iop_SubF128:
+  case Iop_SubF32:
+  case Iop_SubF64:
+  case Iop_SubF64r32:
+  case Iop_MAddF32:
+  case Iop_MAddF64:
+  case Iop_MAddF64r32:
+  case Iop_MSubF32:
+  case Iop_MSubF64:
+  case Iop_MSubF64r32:
+    return True;
+  default:
+    return False;
+  }
+}
+
+#ifdef USE_MPFR
+// The bits a value has are only as good as the bits of the values it
+// was computed from, so raising a site's precision is only worth it
+// if the sites feeding it come along too. Walk back through the
+// expression that made the value, as far as its nodes are still
+// around, raising each site on the way. Returns whether any of them
+// went up.
+static Bool raiseProducerPrecision(ConcExpr* expr, int wantedBits,
+                                   int depth){
+  if (expr == NULL || expr->type == Node_Leaf){
+    return False;
+  }
+  ShadowOpInfo* producer = concExprOp(expr);
+  Bool raised = False;
+  if (producer->precision < wantedBits){
+    if (print_errors_long){
+      VG_(printf)("Raising precision of ");
+      printOpInfo(producer);
+      VG_(printf)(" from %d to %d bits.\n",
+                  producer->precision, wantedBits);
+    }
+    producer->precision = wantedBits;
+    raised = True;
+  }
+  if (depth <= 1){
+    return raised;
+  }
+  // A site having enough bits doesn't mean the ones behind it do,
+  // since it might have been raised at the end of a shorter walk, so
+  // that's tracked separately.
+  if (producer->producers_precision >= wantedBits &&
+      producer->producers_depth >= depth - 1){
+    return raised;
+  }
+  for(int i = 0; i < expr->nargs; ++i){
+    if (raiseProducerPrecision(concExprArg(expr, i), wantedBits, depth - 1)){
+      raised = True;
+    }
+  }
+  if (wantedBits >= producer->producers_precision &&
+      depth - 1 >= producer->producers_depth){
+    producer->producers_precision = wantedBits;
+    producer->producers_depth = depth - 1;
+  } else {
+    // Everything as far back as the longer of the two walks has at
+    // least as many bits as the smaller of the two asked for.
+    if (wantedBits < producer->producers_precision){
+      producer->producers_precision = wantedBits;
+    }
+    if (depth - 1 > producer->producers_depth){
+      producer->producers_depth = depth - 1;
+    }
+  }
+  return raised;
+}
+#endif
+
+// Each mpfr operation is correctly rounded, so how many bits a site
+// needs isn't something it can find out by itself; it depends on how
+// much of its result gets cancelled away by the sites that use
+// it. So additions check how many bits they cancelled, and if that
+// left less than SITE_NEEDED_BITS of an argument, raise the
+// precision of the site that computed that argument, and of the
+// sites behind it, enough to cover it next time around. The estimate
+// of how good an argument is only goes by how many bits it was
+// stored with, so this can't see error that built up in a chain of
+// sites that never cancel. It works off of the argument expressions,
+// so sites that don't track expressions aren't adapted.
+//
+// Returns whether it raised anything. If it did, the result it was
+// given came from arguments with too few bits, and its error can't
+// be trusted.
+Bool adaptPrecision(ShadowOpInfo* info, Real result,
+                    ShadowValue** args, int nargs){
+  #ifdef USE_MPFR
+  if (no_exprs || !isAdditiveOp(info->op_code)){
+    return False;
+  }
+  long resultExp;
+  Bool resultRegular = realExponent(result, &resultExp);
+  Bool raised = False;
+  for(int i = 0; i < nargs; ++i){
+    ConcExpr* argExpr = args[i]->expr;
+    // Values straight from the client are exact.
+    if (argExpr == NULL || argExpr->type == Node_Leaf){
+      continue;
+    }
+    long argExp;
+    if (!realExponent(args[i]->real, &argExp)){
+      continue;
+    }
+    int argBits = realPrecision(args[i]->real);
+    int wantedBits;
+    if (resultRegular){
+      long cancelled = argExp - resultExp;
+      if (argBits - cancelled >= SITE_NEEDED_BITS){
+        continue;
+      }
+      wantedBits = SITE_NEEDED_BITS + cancelled;
+    } else if (getDouble(result) == 0.0){
+      // Everything cancelled, so we don't know how much more we'd
+      // need. Try double.
+      wantedBits = argBits * 2;
+    } else {
+      continue;
+    }
+    // Round up to whole limbs, since that's what mpfr computes with
+    // anyway.
+    wantedBits = (wantedBits + 63) & ~63;
+    if (wantedBits > precision){
+      wantedBits = precision;
+    }
+    if (raiseProducerPrecision(argExpr, wantedBits, max_expr_block_depth)){
+      raised = True;
+    }
+  }
+  return raised;
+  #else
+  return False;
+  #endif
+}
+
+#ifdef USE_MPFR
+static DDOpResult execRealOpDD(IROp op_code, Real result,
+                               ShadowValue** args, int nargs){
+  const DoubleDouble* dargs[3];
+  for(int i = 0; i < nargs && i < 3; ++i){
+    if (args[i]->real->escalated){
+      return DD_Escalate;
+    }
+    dargs[i] = &(args[i]->real->dd);
+    // Infinities, NaNs, and values near the ends of the range go to
+    // mpfr, which knows how to handle them.
+    if (!ddInSafeRange(dargs[i])){
+      return DD_Escalate;
+    }
+  }
+  DoubleDouble res;
+  switch((int)op_code){
+  case Iop_Abs32Fx4:
+  case Iop_Abs32Fx2:
+  case Iop_Abs64Fx2:
+  case Iop_AbsF32:
+  case Iop_AbsF64:
+    res = *dargs[0];
+    if (res.hi < 0){
+      res.hi = -res.hi;
+      res.lo = -res.lo;
+    }
+    break;
+  case Iop_Neg32Fx4:
+  case IEop_Neg32F0x4:
+  case Iop_Neg32Fx2:
+  case Iop_Neg64Fx2:
+  case IEop_Neg64F0x2:
+  case Iop_NegF32:
+  case Iop_NegF64:
+    res = *dargs[0];
+    res.hi = -res.hi;
+    res.lo = -res.lo;
+    break;
+  case Iop_SqrtF64:
+  case Iop_SqrtF32:
+  case Iop_Sqrt32F0x4:
+  case Iop_Sqrt64F0x2:
+  case Iop_Sqrt64Fx2:
+    if (dargs[0]->hi < 0){
+      return DD_Escalate;
+    }
+    ddSqrt(&res, dargs[0]);
+    break;
+  case Iop_Add64Fx4:
+  case Iop_Add64Fx2:
+  case Iop_Add64F0x2:
+  case Iop_Add32F0x4:
+  case Iop_Add32Fx2:
+  case Iop_Add32Fx4:
+  case Iop_Add32Fx8:
+  case Iop_AddF128:
+  case Iop_AddF64:
+  case Iop_AddF32:
+  case Iop_AddF64r32:
+    ddAdd(&res, dargs[0], dargs[1]);
+    break;
+  case Iop_Sub64F0x2:
+  case Iop_Sub32F0x4:
+  case Iop_Sub32Fx2:
+  case Iop_Sub32Fx8:
+  case Iop_Sub64Fx4:
+  case Iop_Sub32Fx4:
+  case Iop_Sub64Fx2:
+  case Iop_SubF128:
+  case Iop_SubF32:
+  case Iop_SubF64:
+  case Iop_SubF64r32:
+    ddSub(&res, dargs[0], dargs[1]);
+    break;
+  case Iop_Mul32F0x4:
+  case Iop_Mul64F0x2:
+  case Iop_Mul32Fx8:
+  case Iop_Mul64Fx4:
+  case Iop_Mul32Fx4:
+  case Iop_Mul64Fx2:
+  case Iop_MulF128:
+  case Iop_MulF64:
+  case Iop_MulF32:
+  case Iop_MulF64r32:
+    ddMul(&res, dargs[0], dargs[1]);
+    break;
+  case Iop_Div32F0x4:
+  case Iop_Div64F0x2:
+  case Iop_Div32Fx8:
+  case Iop_Div64Fx4:
+  case Iop_Div32Fx4:
+  case Iop_DivF128:
+  case Iop_DivF64:
+  case Iop_DivF32:
+  case Iop_DivF64r32:
+  case Iop_Div64Fx2:
+    if (dargs[1]->hi == 0.0){
+      return DD_Escalate;
+    }
+    ddDiv(&res, dargs[0], dargs[1]);
+    break;
+  case Iop_Max64F0x2:
+  case Iop_Max64Fx2:
+  case Iop_Max32F0x4:
+  case Iop_Max32Fx4:
+  case Iop_Max32Fx2:
+    res = ddCompare(dargs[0], dargs[1]) > 0 ? *dargs[0] : *dargs[1];
+    break;
+  case Iop_Min64F0x2:
+  case Iop_Min64Fx2:
+  case Iop_Min32F0x4:
+  case Iop_Min32Fx4:
+  case Iop_Min32Fx2:
+    res = ddCompare(dargs[0], dargs[1]) < 0 ? *dargs[0] : *dargs[1];
+    break;
+  case Iop_MAddF32:
+  case Iop_MAddF64:
+  case Iop_MAddF64r32:
+    ddMul(&res, dargs[0], dargs[1]);
+    ddAdd(&res, &res, dargs[2]);
+    break;
+  case Iop_MSubF32:
+  case Iop_MSubF64:
+  case Iop_MSubF64r32:
+    ddMul(&res, dargs[0], dargs[1]);
+    ddSub(&res, &res, dargs[2]);
+    break;
+  default:
+    return DD_Unsupported;
+  }
+  if (res.bits < DD_MIN_BITS || !ddInSafeRange(&res)){
+    return DD_Escalate;
+  }
+  result->dd = res;
+  result->escalated = False;
+  return DD_Done;
+}
+#endif
+
+// The high precision versions of each operation, which
+// getRealOpKernel picks between.
+#define UNARY_KERNEL(name, f)                                   \
+  static void name(Real result, ShadowValue** args){            \
+    CALL1(f, RRES(result), RARG(args[0]->real));                \
+  }
+#define BINARY_KERNEL(name, f)                                  \
+  static void name(Real result, ShadowValue** args){            \
+    CALL2(f, RRES(result),                                      \
+          RARG(args[0]->real),                                  \
+          RARG(args[1]->real));                                 \
+  }
+#define TERNARY_KERNEL(name, f)                                 \
+  static void name(Real result, ShadowValue** args){            \
+    CALL3(f, RRES(result),                                      \
+          RARG(args[0]->real),                                  \
+          RARG(args[1]->real),                                  \
+          RARG(args[2]->real));                                 \
+  }
+#ifdef USE_MPFR
+#define MPFR_UNARY_KERNEL(name, f, instr) UNARY_KERNEL(name, f)
+#define MPFR_BINARY_KERNEL(name, f, instr) BINARY_KERNEL(name, f)
+#else
+#define MPFR_UNARY_KERNEL(name, f, instr)                               \
+  static void name(Real result, ShadowValue** args){                    \
+    tl_assert2(0, "GMP doesn't support shadowing the " instr " instruction"); \
+  }
+#define MPFR_BINARY_KERNEL(name, f, instr) MPFR_UNARY_KERNEL(name, f, instr)
+#endif
+
+UNARY_KERNEL(recipKernel, recip)
+UNARY_KERNEL(recSqrtKernel, rec_sqrt)
+UNARY_KERNEL(absKernel, abs)
+UNARY_KERNEL(negKernel, neg)
+MPFR_UNARY_KERNEL(sinKernel, sin, "Sin64")
+MPFR_UNARY_KERNEL(cosKernel, cos, "Cos64")
+MPFR_UNARY_KERNEL(tanKernel, tan, "Tan64")
+MPFR_UNARY_KERNEL(twoXm1Kernel, 2xm1, "2xm164")
+MPFR_UNARY_KERNEL(recpExpKernel, recp_exp, "recpexp")
+static void sqrtKernel(Real result, ShadowValue** args){
+  if (getDouble(args[0]->real) >= 0.0){
+    CALL1(sqrt, RRES(result), RARG(args[0]->real));
+  } else {
+    #ifdef USE_MPFR
+    mpfr_set_nan(RRES(result));
+    #else
+    tl_assert2(0, "I don't think GMP supports NaN");
+    #endif
+  }
+}
+BINARY_KERNEL(recipStepKernel, recip_step)
+BINARY_KERNEL(recipSqrtStepKernel, recip_sqrt_step)
+BINARY_KERNEL(addKernel, add)
+BINARY_KERNEL(subKernel, sub)
+BINARY_KERNEL(mulKernel, mul)
+static void divKernel(Real result, ShadowValue** args){
+  if (getDouble(args[1]->real) != 0.0){
+    CALL2(div, RRES(result),
+          RARG(args[0]->real),
+          RARG(args[1]->real));
+  } else {
+    #ifdef USE_MPFR
+    mpfr_set_nan(RRES(result));
+    #else
+    tl_assert2(0, "I don't think GMP supports NaN");
+    #endif
+  }
+}
+BINARY_KERNEL(maxKernel, max)
+BINARY_KERNEL(minKernel, min)
+MPFR_BINARY_KERNEL(atan2Kernel, atan2, "atan64")
+MPFR_BINARY_KERNEL(yl2xKernel, yl2x, "y12xf64")
+MPFR_BINARY_KERNEL(yl2xpKernel, yl2xp, "t12xp1f64")
+MPFR_BINARY_KERNEL(scaleKernel, scale, "scale64")
+TERNARY_KERNEL(fmaKernel, fma)
+TERNARY_KERNEL(fmsKernel, fms)
+
+RealOpKernel getRealOpKernel(IROp_Extended op_code){
   switch((int)op_code){
   case Iop_RecipEst32Fx4:
   case Iop_RecipEst32Fx2:
   case Iop_RecipEst64Fx2:
   case Iop_RecipEst32F0x4:
-    CALL1(recip, (*result)->RVAL, args[0]->real->RVAL);
-    break;
+    return recipKernel;
   case Iop_RSqrtEst32Fx4:
   case Iop_RSqrtEst32F0x4:
   case Iop_RSqrtEst64Fx2:
   case Iop_RSqrtEst32Fx2:
   case Iop_RSqrtEst5GoodF64:
-    CALL1(rec_sqrt, (*result)->RVAL, args[0]->real->RVAL);
-    break;
+    return recSqrtKernel;
   case Iop_Abs32Fx4:
   case Iop_Abs32Fx2:
   case Iop_Abs64Fx2:
   case Iop_AbsF32:
   case Iop_AbsF64:
-    CALL1(abs, (*result)->RVAL, args[0]->real->RVAL);
-    break;
+    return absKernel;
   case Iop_Neg32Fx4:
   case IEop_Neg32F0x4:
   case Iop_Neg32Fx2:
@@ -65,75 +719,33 @@ void execRealOp(IROp op_code, Real* result, ShadowValue** args){
   case IEop_Neg64F0x2:
   case Iop_NegF32:
   case Iop_NegF64:
-    CALL1(neg, (*result)->RVAL, args[0]->real->RVAL);
-    break;
+    return negKernel;
   case Iop_SinF64:
-    #ifndef USE_MPFR
-    tl_assert2(0, "GMP doesn't support shadowing the Sin64 instruction");
-    #else
-    CALL1(sin, (*result)->RVAL, args[0]->real->RVAL);
-    #endif
-    break;
+    return sinKernel;
   case Iop_CosF64:
-    #ifndef USE_MPFR
-    tl_assert2(0, "GMP doesn't support shadowing the Cos64 instruction");
-    #else
-    CALL1(cos, (*result)->RVAL, args[0]->real->RVAL);
-    #endif
-    break;
+    return cosKernel;
   case Iop_TanF64:
-    #ifndef USE_MPFR
-    tl_assert2(0, "GMP doesn't support shadowing the Tan64 instruction");
-    #else
-    CALL1(tan, (*result)->RVAL, args[0]->real->RVAL);
-    #endif
-    break;
+    return tanKernel;
   case Iop_2xm1F64:
-    #ifndef USE_MPFR
-    tl_assert2(0, "GMP doesn't support shadowing the 2xm164 instruction");
-    #else
-    CALL1(2xm1, (*result)->RVAL, args[0]->real->RVAL);
-    #endif
-    break;
+    return twoXm1Kernel;
   case Iop_SqrtF64:
   case Iop_SqrtF32:
   case Iop_Sqrt32F0x4:
   case Iop_Sqrt64F0x2:
   case Iop_Sqrt64Fx2:
-    if (GETD(args[0]->real->RVAL) >= 0.0){
-      CALL1(sqrt, (*result)->RVAL, args[0]->real->RVAL);
-    } else {
-      #ifdef USE_MPFR
-      mpfr_set_nan((*result)->RVAL);
-      #else
-      tl_assert2(0, "I don't think GMP supports NaN");
-      #endif
-    }
-    break;
+    return sqrtKernel;
   case Iop_RecpExpF64:
   case Iop_RecpExpF32:
-    #ifndef USE_MPFR
-    tl_assert2(0,
-               "GMP doesn't support shadowing the recpexp instructions");
-    #else
-    CALL1(recp_exp, (*result)->RVAL, args[0]->real->RVAL);
-    #endif
-    break;
+    return recpExpKernel;
     // Binary Ops
   case Iop_RecipStep32Fx4:
   case Iop_RecipStep32Fx2:
   case Iop_RecipStep64Fx2:
-    CALL2(recip_step, (*result)->RVAL,
-          args[0]->real->RVAL,
-          args[1]->real->RVAL);
-    break;
+    return recipStepKernel;
   case Iop_RSqrtStep32Fx4:
   case Iop_RSqrtStep32Fx2:
   case Iop_RSqrtStep64Fx2:
-    CALL2(recip_sqrt_step, (*result)->RVAL,
-          args[0]->real->RVAL,
-          args[1]->real->RVAL);
-    break;
+    return recipSqrtStepKernel;
   case Iop_Add64Fx4:
   case Iop_Add64Fx2:
   case Iop_Add64F0x2:
@@ -145,10 +757,7 @@ void execRealOp(IROp op_code, Real* result, ShadowValue** args){
   case Iop_AddF64:
   case Iop_AddF32:
   case Iop_AddF64r32:
-    CALL2(add, (*result)->RVAL,
-          args[0]->real->RVAL,
-          args[1]->real->RVAL);
-    break;
+    return addKernel;
   case Iop_Sub64F0x2:
   case Iop_Sub32F0x4:
   case Iop_Sub32Fx2:
@@ -160,10 +769,7 @@ void execRealOp(IROp op_code, Real* result, ShadowValue** args){
   case Iop_SubF32:
   case Iop_SubF64:
   case Iop_SubF64r32:
-    CALL2(sub, (*result)->RVAL,
-          args[0]->real->RVAL,
-          args[1]->real->RVAL);
-    break;
+    return subKernel;
   case Iop_Mul32F0x4:
   case Iop_Mul64F0x2:
   case Iop_Mul32Fx8:
@@ -174,10 +780,7 @@ void execRealOp(IROp op_code, Real* result, ShadowValue** args){
   case Iop_MulF64:
   case Iop_MulF32:
   case Iop_MulF64r32:
-    CALL2(mul, (*result)->RVAL,
-          args[0]->real->RVAL,
-          args[1]->real->RVAL);
-    break;
+    return mulKernel;
   case Iop_Div32F0x4:
   case Iop_Div64F0x2:
   case Iop_Div32Fx8:
@@ -188,100 +791,51 @@ void execRealOp(IROp op_code, Real* result, ShadowValue** args){
   case Iop_DivF32:
   case Iop_DivF64r32:
   case Iop_Div64Fx2:
-    if (GETD(args[1]->real->RVAL) != 0.0){
-      CALL2(div, (*result)->RVAL,
-            args[0]->real->RVAL,
-            args[1]->real->RVAL);
-    } else {
-      #ifdef USE_MPFR
-      mpfr_set_nan((*result)->RVAL);
-      #else
-      tl_assert2(0, "I don't think GMP supports NaN");
-      #endif
-    }
-    break;
+    return divKernel;
   case Iop_Max64F0x2:
   case Iop_Max64Fx2:
   case Iop_Max32F0x4:
   case Iop_Max32Fx4:
   case Iop_Max32Fx2:
-    CALL2(max, (*result)->RVAL,
-          args[0]->real->RVAL,
-          args[1]->real->RVAL);
-    break;
+    return maxKernel;
   case Iop_Min64F0x2:
   case Iop_Min64Fx2:
   case Iop_Min32F0x4:
   case Iop_Min32Fx4:
   case Iop_Min32Fx2:
-    CALL2(min, (*result)->RVAL,
-          args[0]->real->RVAL,
-          args[1]->real->RVAL);
-    break;
+    return minKernel;
   /* case Iop_XorV128: */
   case Iop_AtanF64:
-    #ifndef USE_MPFR
-    tl_assert2(0, "GMP doesn't support shadwing the atan64 instruction");
-    #else
-    CALL2(atan2, (*result)->RVAL,
-          args[0]->real->RVAL,
-          args[1]->real->RVAL);
-    #endif
-    break;
+    return atan2Kernel;
   case Iop_Yl2xF64:
-    #ifndef USE_MPFR
-    tl_assert2(0,
-               "GMP doesn't support shadowing the y12xf64 instruction");
-    #else
-    CALL2(yl2x, (*result)->RVAL,
-          args[0]->real->RVAL,
-          args[1]->real->RVAL);
-    #endif
-    break;
+    return yl2xKernel;
   case Iop_Yl2xp1F64:
-    #ifndef USE_MPFR
-    tl_assert2(0,
-               "GMP doesn't support shadowing the t12xp1f64 instruction");
-    #else
-    CALL2(yl2xp, (*result)->RVAL,
-          args[0]->real->RVAL,
-          args[1]->real->RVAL);
-    #endif
-    break;
+    return yl2xpKernel;
   case Iop_ScaleF64:
-    #ifndef USE_MPFR
-    tl_assert2(0,
-               "GMP doesn't support shadowing the scale64 instruction");
-    #else
-    CALL2(scale, (*result)->RVAL,
-          args[0]->real->RVAL,
-          args[1]->real->RVAL);
-    #endif
-    break;
+    return scaleKernel;
     // Quadnary ops
   case Iop_MAddF32:
   case Iop_MAddF64:
   case Iop_MAddF64r32:
-    CALL3(fma, (*result)->RVAL,
-          args[0]->real->RVAL,
-          args[1]->real->RVAL,
-          args[2]->real->RVAL);
-    break;
+    return fmaKernel;
   case Iop_MSubF32:
   case Iop_MSubF64:
   case Iop_MSubF64r32:
-    CALL3(fms, (*result)->RVAL,
-          args[0]->real->RVAL,
-          args[1]->real->RVAL,
-          args[2]->real->RVAL);
-    break;
+    return fmsKernel;
   default:
+    return NULL;
+  }
+}
+static void execRealOpHighPrecision(IROp op_code, RealOpKernel kernel,
+                                    Real* result, ShadowValue** args){
+  if (kernel == NULL){
     VG_(printf)("Don't recognize (%d) ", op_code);
     ppIROp_Extended(op_code);
     VG_(printf)("\n");
     tl_assert(0);
     return;
   }
+  kernel(*result, args);
 }
 DEF1(recip){
   RET CALL2(ui_div, res, 1, arg);
@@ -37,7 +37,8 @@
 
 #ifdef USE_MPFR
 #include "mpfr.h"
-#define RVAL mpfr_val
+#define RARG(r) realMPFR(r)
+#define RRES(r) realMPFRResult(r)
 #define CALL1(f, result, arg) mpfr_##f(result, arg, MPFR_RNDN)
 #define CALL2(f, result, arg1, arg2) \
   mpfr_##f(result, arg1, arg2, MPFR_RNDN)
@@ -53,12 +54,11 @@
   int mpfr_##f(mpfr_t res, \
                mpfr_srcptr arg1, mpfr_srcptr arg2, mpfr_srcptr arg3,   \
                mpfr_rnd_t round)
-#define GETD(v)                                 \
-  mpfr_get_d(v, MPFR_RNDN)
 #define RET return
 #else
 #include "gmp.h"
-#define RVAL mpf_val
+#define RARG(r) (forceReal(r), (r)->mpf_val)
+#define RRES(r) ((r)->mpf_val)
 #define CALL1(f, result, arg) mpf_##f(result, arg)
 #define CALL2(f, result, arg1, arg2) \
   mpf_##f(result, arg1, arg2)
@@ -70,12 +70,37 @@
   void mpf_##f(mpf_t res, mpf_t arg1, mpf_t arg2)
 #define DEF3(f) \
   void mpf_##f(mpf_t res, mpf_t arg1, mpf_t arg2, mpf_t arg3)
-#define GETD(v) \
-  mpf_get_d(v)
 #define RET
 #endif
 
 void execRealOp(IROp op_code, Real* result, ShadowValue** args);
+// Like execRealOp, but with the kernel and number of arguments
+// already looked up, as in a ShadowOpPlan.
+void execRealOpKernel(IROp op_code, RealOpKernel kernel, int nargs,
+                      Real* result, ShadowValue** args);
+// The function that computes an operation in high precision, or NULL
+// if we don't know how to shadow it.
+RealOpKernel getRealOpKernel(IROp_Extended op_code);
+// Record an execution of opinfo in the real of its result instead of
+// running it, so it only gets run, and measured with
+// measureDeferredOp, if something reads the result. This might run
+// it anyway, if the result would depend on too long a chain of
+// pending reals; then it's left to the caller to measure.
+void deferRealOp(ShadowOpInfo* opinfo, ShadowValue* result,
+                 ShadowValue** args, int nargs,
+                 double* clientArgs, double clientResult);
+Bool realOpIsExact(IROp op_code, double* args, double result);
+// Throw away the pending operation of a real that's being freed
+// without ever having been read.
+void dropPendingReal(Real real);
+#ifdef USE_MPFR
+void settleRealResult(Real result, ShadowValue** args, int nargs);
+#endif
+// With --adaptive-precision, raise the precision of the sites behind
+// an addition that cancelled away too much of them. Returns whether
+// anything was raised, in which case the result isn't to be trusted.
+Bool adaptPrecision(ShadowOpInfo* info, Real result,
+                    ShadowValue** args, int nargs);
 DEF1(recip);
 DEF2(recip_step);
 DEF2(recip_sqrt_step);
@@ -40,8 +40,100 @@
 #include "../../helper/ir-info.h"
 #include "../../helper/runtime-util.h"
 
-VG_REGPARM(1) ShadowTemp* executeShadowOp(ShadowOpInfoInstance* infoInstance){
+// With --elide-exact-values, a channel whose arguments are all
+// unshadowed, and so exactly their client values, gets no shadow
+// value either when the operation is exact on them. A NULL value
+// already means "just the client value" everywhere else, so this
+// costs nothing downstream, but it does leave the operation out of
+// the expressions of anything computed from it.
+static Bool channelIsExact(ShadowOpInfo* opInfo, ShadowTemp** args, int nargs,
+                           int channel, double* clientArgs,
+                           double clientResult){
+  for(int i = 0; i < nargs; ++i){
+    if (args[i]->values[channel] != NULL){
+      return False;
+    }
+  }
+  return realOpIsExact(opInfo->op_code, clientArgs, clientResult);
+}
+
+static Bool isMulOp(IROp_Extended op_code){
+  switch((int)op_code){
+  case Iop_Mul32F0x4:
+  case Iop_Mul64F0x2:
+  case Iop_Mul32Fx8:
+  case Iop_Mul64Fx4:
+  case Iop_Mul32Fx4:
+  case Iop_Mul64Fx2:
+  case Iop_MulF64:
+  case Iop_MulF128:
+  case Iop_MulF32:
+  case Iop_MulF64r32:
+    return True;
+  default:
+    return False;
+  }
+}
+
+void initShadowOpPlan(ShadowOpPlan* plan, ShadowOpInfo* opInfo){
+  IROp_Extended op_code = opInfo->op_code;
+  plan->numBlocks = numOpBlocks(op_code);
+  plan->numArgBlocks = numOpArgBlocks(op_code);
+  plan->nargs = numFloatArgs(opInfo);
+  tl_assert(plan->nargs <= 4);
+  plan->numChannels = numChannelsOut(op_code);
+  tl_assert(plan->numChannels <= MAX_TEMP_BLOCKS);
+  plan->argPrecision = opArgPrecision(op_code);
+  plan->numOperandBlocks =
+    numSIMDOperands(op_code) * (plan->argPrecision == Vt_Double ? 2 : 1);
+  for(int j = 0; j < plan->numChannels; ++j){
+    plan->channelArgPrecisions[j] = opBlockArgPrecision(op_code, j / 2);
+  }
+  plan->isMul = isMulOp(op_code);
+  plan->kernel = getRealOpKernel(op_code);
+}
+
+// Whether an execution of a site is one that wouldn't have been any
+// different unshadowed: the site has never had any error, nothing
+// erroneous is flowing through it, and its expression has stopped
+// changing.
+static Bool isCleanExecution(ShadowOpInfo* opinfo, ShadowTemp* result,
+                             int numOperandBlocks){
+  if (opinfo->agg.global_error.max_error > 0 ||
+      opinfo->agg.local_error.max_error > 0){
+    return False;
+  }
+  if (opinfo->expr != NULL && expr_converge_threshold > 0 &&
+      opinfo->stable_merges < expr_converge_threshold){
+    return False;
+  }
+  for(int i = 0; i < numOperandBlocks; ++i){
+    if (result->values[i] != NULL &&
+        result->values[i]->influences != NULL){
+      return False;
+    }
+  }
+  return True;
+}
+// With --lazy-reals, an execution whose reals were deferred hasn't had
+// its error measured yet, so it can't count as clean either.
+static Bool isMeasuredExecution(ShadowTemp* result, int numOperandBlocks){
+  if (no_reals){
+    return True;
+  }
+  for(int i = 0; i < numOperandBlocks; ++i){
+    if (result->values[i] != NULL &&
+        result->values[i]->real->pending != NULL){
+      return False;
+    }
+  }
+  return True;
+}
+static ShadowTemp* runShadowOpInstance(ShadowOpInfoInstance* infoInstance,
+                                       const ArgUnion* clientArgVals,
+                                       const ResultUnion* clientResult){
   ShadowOpInfo* opInfo = infoInstance->info;
+  const ShadowOpPlan* plan = &(infoInstance->plan);
   // Make sure the op code is sane, so that things don't go bonkers
   // later.
   tl_assert(((IROp)opInfo->op_code) > Iop_INVALID);
@@ -49,40 +141,45 @@ VG_REGPARM(1) ShadowTemp* executeShadowOp(ShadowOpInfoInstance* infoInstance){
             IEop_REALLY_LAST_FOR_REAL_GUYS);
 
   // Create a shadow temp for the result.
-  FloatBlocks numBlocks = numOpBlocks(opInfo->op_code);
-  FloatBlocks numArgBlocks = numOpArgBlocks(opInfo->op_code);
-  ShadowTemp* result = mkShadowTemp(numBlocks);
+  ShadowTemp* result = mkShadowTemp(plan->numBlocks);
 
   // Get the computed and shadow arguments.
-  int nargs = numFloatArgs(opInfo);
-  tl_assert(nargs <= 4);
-  int numChannels = numChannelsOut(opInfo->op_code);
-  tl_assert(numChannels <= MAX_TEMP_BLOCKS);
+  int nargs = plan->nargs;
+  int numChannels = plan->numChannels;
   ShadowTemp* args[4];
   double clientArgs[4][MAX_TEMP_BLOCKS];
   for(int i = 0; i < nargs; ++i){
     args[i] = getArg(i, opInfo->op_code, infoInstance->argTemps[i]);
-    tl_assert2(INT(args[i]->num_blocks) == INT(numArgBlocks),
+    tl_assert2(INT(args[i]->num_blocks) == INT(plan->numArgBlocks),
                "Arg has %d blocks, but op blocks is %d\n",
-               INT(args[i]->num_blocks), INT(numArgBlocks));
+               INT(args[i]->num_blocks), INT(plan->numArgBlocks));
     for (int j = 0; j < numChannels; ++j){
-      ValueType argPrecision = opBlockArgPrecision(opInfo->op_code, j / 2);
-      clientArgs[j][i] = argPrecision == Vt_Double ?
-        computedArgs.argValues[i][j] :
-        computedArgs.argValuesF[i][j];
+      clientArgs[j][i] = plan->channelArgPrecisions[j] == Vt_Double ?
+        clientArgVals->argValues[i][j] :
+        clientArgVals->argValuesF[i][j];
     }
   }
   // Do the operation on the operand channels
-  int numOperandChannels = numSIMDOperands(opInfo->op_code);
-  int numOperandBlocks =
-    numOperandChannels * (opArgPrecision(opInfo->op_code) == Vt_Double ? 2 : 1);
+  int numOperandBlocks = plan->numOperandBlocks;
+  ValueType argPrecision = plan->argPrecision;
   for(int i = 0; i < numOperandBlocks; ++i){
     ShadowValue* vals[MAX_TEMP_BLOCKS];
-    ValueType argPrecision = opArgPrecision(opInfo->op_code);
     if (argPrecision == Vt_Double && i % 2 == 1){
       result->values[i] = NULL;
       continue;
     }
+    double computedOutput = (argPrecision == Vt_Single ?
+       clientResult->f[i] : clientResult->d[i / 2]);
+    if (elide_exact_values &&
+        channelIsExact(opInfo, args, nargs, i, clientArgs[i],
+                       computedOutput)){
+      result->values[i] = NULL;
+      opInfo->elided_calls++;
+      if (use_ranges){
+        updateRanges(opInfo->agg.inputs.range_records, clientArgs[i], nargs);
+      }
+      continue;
+    }
     for(int j = 0; j < nargs; ++j){
       if (args[j]->values[i] == NULL){
         args[j]->values[i] = mkShadowValue(argPrecision, clientArgs[i][j]);
@@ -93,16 +190,18 @@ VG_REGPARM(1) ShadowTemp* executeShadowOp(ShadowOpInfoInstance* infoInstance){
       }
       vals[j] = args[j]->values[i];
     }
-    double computedOutput = (argPrecision == Vt_Single ?
-       computedResult.f[i] : computedResult.d[i / 2]);
     result->values[i] =
-      executeChannelShadowOp(opInfo,
+      executeChannelShadowOp(opInfo, plan,
                              vals,
                              clientArgs[i],
                              computedOutput);
   }
+  if (retire_after > 0 && isMeasuredExecution(result, numOperandBlocks)){
+    updateRetirement(opInfo,
+                     isCleanExecution(opInfo, result, numOperandBlocks));
+  }
   // Copy across argument on the non-operand channels
-  for(int i = numOperandBlocks; i < INT(numBlocks); ++i){
+  for(int i = numOperandBlocks; i < INT(plan->numBlocks); ++i){
     // According to the libvex_ir.h documentation, the non-operated
     // values should be copied from the first operand.
     result->values[i] = args[0]->values[i];
@@ -125,10 +224,10 @@ VG_REGPARM(1) ShadowTemp* executeShadowOp(ShadowOpInfoInstance* infoInstance){
         VG_(printf)(", %p", result->values[i]);
       }
     }
-    if (numOperandBlocks < INT(numBlocks)){
+    if (numOperandBlocks < INT(plan->numBlocks)){
       VG_(printf)(" and copying shadow value(s) ");
       for(int i = numOperandBlocks;
-          i < INT(numBlocks); ++i){
+          i < INT(plan->numBlocks); ++i){
         if (result->values[i] != NULL){
           VG_(printf)("%p (new rc %lu), ",
                       result->values[i], result->values[i]->ref_count);
@@ -150,56 +249,186 @@ VG_REGPARM(1) ShadowTemp* executeShadowOp(ShadowOpInfoInstance* infoInstance){
   }
   return result;
 }
+VG_REGPARM(1) ShadowTemp* executeShadowOp(ShadowOpInfoInstance* infoInstance){
+  return runShadowOpInstance(infoInstance, &computedArgs, &computedResult);
+}
+// With --sample-rate, whether this execution of the site gets
+// shadowed. Like the inline check for unbatched ops, the first one
+// always is.
+static Bool sampleSite(ShadowOpInfo* opinfo){
+  if (opinfo->sample_countdown > 0){
+    opinfo->sample_countdown--;
+    opinfo->unsampled_calls += numSIMDOperands(opinfo->op_code);
+    return False;
+  }
+  opinfo->sample_countdown = sample_rate - 1;
+  return True;
+}
+static ULong numOpBatchesRun = 0;
+static ULong numBatchedOpsRun = 0;
+VG_REGPARM(1) void executeOpBatch(OpBatch* batch){
+  numOpBatchesRun++;
+  numBatchedOpsRun += batch->numOps;
+  for(int i = 0; i < batch->numOps; ++i){
+    // Leaving the destination alone means it reads as unshadowed.
+    if (sample_rate > 1 && !sampleSite(batch->instances[i]->info)){
+      continue;
+    }
+    ShadowTemp* result =
+      runShadowOpInstance(batch->instances[i],
+                          &(opBatchSlots[i].args),
+                          &(opBatchSlots[i].result));
+    setShadowTemp(batch->dests[i], result);
+  }
+}
+void printOpBatchStats(void){
+  if (numOpBatchesRun == 0){
+    return;
+  }
+  VG_(umsg)("herbgrind: ran %llu batched ops in %llu batches "
+            "(%llu.%02llu per batch).\n",
+            numBatchedOpsRun, numOpBatchesRun,
+            numBatchedOpsRun / numOpBatchesRun,
+            numBatchedOpsRun * 100 / numOpBatchesRun % 100);
+}
 ShadowTemp* getArg(int argIdx, IROp op, IRTemp argTemp){
   if (argTemp == -1 ||
-      shadowTemps[argTemp] == NULL){
+      getShadowTemp(argTemp) == NULL){
     FloatBlocks numBlocks = numOpArgBlocks(op);
-    FloatBlocks numOperandBlocks = numOpOperandBlocks(op);
     ShadowTemp* result = mkShadowTemp(numBlocks);
     if (PRINT_TEMP_MOVES){
       VG_(printf)("Making shadow temp %p (%d blocks) for argument %d\n",
                   result, INT(numBlocks), argIdx);
     }
-    for(int j = 0; j < INT(numOperandBlocks); j++){
-      ValueType argPrecision = opBlockArgPrecision(op, j);
-      if (argPrecision == Vt_NonFloat){
-        result->values[j] = NULL;
-        continue;
-      }
-      double value = argPrecision == Vt_Double ?
-        computedArgs.argValues[argIdx][j] :
-        computedArgs.argValuesF[argIdx][j/2];
-      result->values[j] =
-        mkShadowValue(argPrecision, value);
-      if (PRINT_VALUE_MOVES){
-        VG_(printf)("Making shadow value %p for argument %d block %d (%p) in t%d.\n",
-                    result->values[j], argIdx, j, result, argTemp);
-      }
+    // An unshadowed argument is exactly its client value, so we leave
+    // its blocks empty, and only make values for the ones that get
+    // used (see getArgValue).
+    for(int j = 0; j < INT(numBlocks); j++){
+      result->values[j] = NULL;
     }
     if (argTemp != -1){
       if (PRINT_TEMP_MOVES){
         VG_(printf)("Storing shadow temp %p (%d blocks) at t%d for argument\n",
                     result, INT(numBlocks), argTemp);
       }
-      shadowTemps[argTemp] = result;
+      setShadowTemp(argTemp, result);
     }
     return result;
   } else {
-    return shadowTemps[argTemp];
+    return getShadowTemp(argTemp);
   }
 }
+ShadowValue* getArgValue(ShadowTemp* arg, int argIdx, IROp op, int block){
+  if (arg->values[block] == NULL){
+    ValueType argPrecision = opBlockArgPrecision(op, block);
+    double value = argPrecision == Vt_Double ?
+      computedArgs.argValues[argIdx][block] :
+      computedArgs.argValuesF[argIdx][block/2];
+    arg->values[block] = mkShadowValue(argPrecision, value);
+    if (PRINT_VALUE_MOVES){
+      VG_(printf)("Making shadow value %p for argument %d block %d (%p).\n",
+                  arg->values[block], argIdx, block, arg);
+    }
+  }
+  return arg->values[block];
+}
 void ppInfluenceAddrs(ShadowValue* val);
 void ppInfluenceAddrs(ShadowValue* val){
   tl_assert(val != NULL);
   InfluenceList list = val->influences;
   if (list != NULL && list->length > 0){
-    VG_(printf)("%lX", list->data[0]->op_addr);
+    VG_(printf)("%lX", influenceAt(list, 0)->op_addr);
     for(int i = 1; i < list->length; ++i){
-      VG_(printf)(", and %lX", list->data[i]->op_addr);
+      VG_(printf)(", and %lX", influenceAt(list, i)->op_addr);
+    }
+  }
+}
+// With --lazy-reals, whether this execution of the site is one we
+// measure the error of. The first one always is.
+static Bool sampleLazySite(ShadowOpInfo* opinfo){
+  if (opinfo->lazy_countdown > 0){
+    opinfo->lazy_countdown--;
+    return False;
+  }
+  opinfo->lazy_countdown = lazy_sample_interval - 1;
+  return True;
+}
+// Adding zero, or subtracting it, shouldn't get blamed for error it
+// doesn't make worse, so when one of the arguments is zero in the
+// reals and the error doesn't go up, the result just gets the
+// influences of the other argument. Returns whether that happened.
+static Bool propagateCompensation(ShadowOpInfo* opinfo, ShadowValue* result,
+                                  ShadowValue** args, double* clientArgs,
+                                  double clientResult){
+  switch((int)opinfo->op_code){
+  case Iop_Add32F0x4:
+  case Iop_Add64F0x2:
+  case Iop_AddF64:
+  case Iop_AddF32:
+    if (getDouble(args[0]->real) == 0){
+      ULong inputError = ulpd(getDouble(args[1]->real), clientArgs[1]);
+      ULong outputError = ulpd(getDouble(result->real), clientResult);
+      if (outputError <= inputError){
+        result->influences = cloneInfluences(args[1]->influences);
+        return True;
+      }
     }
+    // Intentional overflow to the next set of cases: both adds and
+    // subtracts are considered compensating if their second
+    // argument is zero in the reals (and the error decreases), but
+    // only adds also are compensating if their first argument is
+    // zero in the reals.
+  case Iop_Sub32F0x4:
+  case Iop_Sub64F0x2:
+  case Iop_SubF64:
+  case Iop_SubF32:
+    if (getDouble(args[1]->real) == 0){
+      ULong inputError = ulpd(getDouble(args[0]->real), clientArgs[0]);
+      ULong outputError = ulpd(getDouble(result->real), clientResult);
+      if (outputError <= inputError){
+        result->influences = cloneInfluences(args[0]->influences);
+        return True;
+      }
+    }
+    return False;
+  default:
+    return False;
+  }
+}
+void measureDeferredOp(ShadowOpInfo* opinfo, ShadowValue* result,
+                       ShadowValue** args, double* clientArgs,
+                       double clientResult){
+  opinfo->lazy_skipped--;
+  double bitsLocalError = 0;
+  if (adaptive_precision &&
+      adaptPrecision(opinfo, result->real, args, numFloatArgs(opinfo))){
+    opinfo->imprecise_calls++;
+  } else {
+    bitsLocalError = execLocalOp(opinfo, result->real, result, args);
+    double bitsGlobalError =
+      updateError(&(opinfo->agg.global_error), result->real, clientResult);
+    flagSymbolicOp(opinfo, result->expr,
+                   bitsGlobalError > error_threshold,
+                   bitsGlobalError > error_threshold ||
+                   bitsLocalError >= error_threshold);
+  }
+  // The arguments were forced before us, so any of them that were
+  // pending have their final influences now, which the ones we
+  // passed along when deferring might be missing.
+  InfluenceList deferredInfluences = result->influences;
+  result->influences = NULL;
+  if (!(compensation_detection &&
+        propagateCompensation(opinfo, result, args,
+                              clientArgs, clientResult))){
+    execInfluencesOp(opinfo, &(result->influences), args,
+                     bitsLocalError >= error_threshold);
+  }
+  if (deferredInfluences != NULL){
+    freeInfluenceList(deferredInfluences);
   }
 }
 ShadowValue* executeChannelShadowOp(ShadowOpInfo* opinfo,
+                                    const ShadowOpPlan* plan,
                                     ShadowValue** args,
                                     double* clientArgs,
                                     double clientResult){
@@ -212,44 +441,30 @@ ShadowValue* executeChannelShadowOp(ShadowOpInfo* opinfo,
   // instruction where the value types DON'T have to match (*32F0x4
   // and *64F0x2), then we should only be run on the first value in
   // that instruction.
-  ValueType argPrecision = opArgPrecision(opinfo->op_code);
-  int nargs = numFloatArgs(opinfo);
-  if (!dont_ignore_pure_zeroes && !no_reals){
-    switch((int)opinfo->op_code){
-    case Iop_Mul32F0x4:
-    case Iop_Mul64F0x2:
-    case Iop_Mul32Fx8:
-    case Iop_Mul64Fx4:
-    case Iop_Mul32Fx4:
-    case Iop_Mul64Fx2:
-    case Iop_MulF64:
-    case Iop_MulF128:
-    case Iop_MulF32:
-    case Iop_MulF64r32:
-      if ((clientArgs[0] == 0 && !isNaN(args[1]->real)) ||
-          (clientArgs[1] == 0 && !isNaN(args[0]->real))){
-        if (print_influences){
-          if (clientArgs[0] == 0 && !isNaN(args[1]->real)){
-            VG_(printf)("Not propagating influences because arg 0 is zero (client val ");
-            ppFloat(clientArgs[0]);
-            VG_(printf)(")\n");
-          } else {
-            VG_(printf)("Not propagating influences because arg 1 is zero (client val ");
-            ppFloat(clientArgs[1]);
-            VG_(printf)(")\n");
-          }
-        }
-        ShadowValue* result =
-          mkShadowValue(argPrecision, clientResult);
-        if (use_ranges){
-          updateRanges(opinfo->agg.inputs.range_records, clientArgs, nargs);
+  ValueType argPrecision = plan->argPrecision;
+  int nargs = plan->nargs;
+  if (plan->isMul && !dont_ignore_pure_zeroes && !no_reals){
+    if ((clientArgs[0] == 0 && !isNaN(args[1]->real)) ||
+        (clientArgs[1] == 0 && !isNaN(args[0]->real))){
+      if (print_influences){
+        if (clientArgs[0] == 0 && !isNaN(args[1]->real)){
+          VG_(printf)("Not propagating influences because arg 0 is zero (client val ");
+          ppFloat(clientArgs[0]);
+          VG_(printf)(")\n");
+        } else {
+          VG_(printf)("Not propagating influences because arg 1 is zero (client val ");
+          ppFloat(clientArgs[1]);
+          VG_(printf)(")\n");
         }
-        execSymbolicOp(opinfo, &(result->expr), clientResult, args, False);
-        return result;
       }
-      break;
-    default:
-      break;
+      ShadowValue* result =
+        mkShadowValue(argPrecision, clientResult);
+      if (use_ranges){
+        updateRanges(opinfo->agg.inputs.range_records, clientArgs, nargs);
+      }
+      execSymbolicOp(opinfo, &(result->expr), clientResult, args,
+                     False, False);
+      return result;
     }
   }
   if (print_inputs){
@@ -262,10 +477,41 @@ ShadowValue* executeChannelShadowOp(ShadowOpInfo* opinfo,
     }
   }
   ShadowValue* result = mkShadowValueBare(argPrecision);
-  execRealOp(opinfo->op_code, &(result->real), args);
+  if (adaptive_precision && !no_reals){
+    setRealPrecision(result->real, opinfo->precision);
+  }
+  if (lazy_reals && !no_reals && !sampleLazySite(opinfo)){
+    deferRealOp(opinfo, result, args, nargs, clientArgs, clientResult);
+  } else {
+    execRealOpKernel(opinfo->op_code, plan->kernel, nargs,
+                     &(result->real), args);
+  }
   if (use_ranges){
     updateRanges(opinfo->agg.inputs.range_records, clientArgs, nargs);
   }
+  if (!no_reals && result->real->pending != NULL){
+    // Everything that measures error needs the real result, so for
+    // now this execution just passes along the influences of its
+    // arguments. If something reads the real, measureDeferredOp does
+    // the rest; until then, it's left out of the site's aggregates
+    // as unmeasured.
+    opinfo->lazy_skipped++;
+    execSymbolicOp(opinfo, &(result->expr), clientResult, args,
+                   False, False);
+    execInfluencesOp(opinfo, &(result->influences), args, False);
+    return result;
+  }
+  if (adaptive_precision && !no_reals &&
+      adaptPrecision(opinfo, result->real, args, nargs)){
+    // This was computed from arguments that didn't have enough bits,
+    // so its error can't be trusted. Leave it out of the aggregates;
+    // the next execution will have the bits.
+    opinfo->imprecise_calls++;
+    execSymbolicOp(opinfo, &(result->expr), clientResult, args,
+                   False, False);
+    execInfluencesOp(opinfo, &(result->influences), args, False);
+    return result;
+  }
 
   if (print_errors_long || print_errors){
     printOpInfo(opinfo);
@@ -274,15 +520,16 @@ ShadowValue* executeChannelShadowOp(ShadowOpInfo* opinfo,
   if (print_errors_long || print_errors){
     VG_(printf)("Local:\n");
   }
-  double bitsLocalError =
-    execLocalOp(opinfo, result->real, result, args);
+  double bitsLocalError = execLocalOp(opinfo, result->real, result, args);
   if (print_errors_long || print_errors){
     VG_(printf)("Global:\n");
   }
   double bitsGlobalError =
     updateError(&(opinfo->agg.global_error), result->real, clientResult);
   execSymbolicOp(opinfo, &(result->expr), clientResult, args,
-                 bitsGlobalError > error_threshold);
+                 bitsGlobalError > error_threshold,
+                 bitsGlobalError > error_threshold ||
+                 bitsLocalError >= error_threshold);
   if (print_expr_refs){
     VG_(printf)("Making new expression %p for value %p with 1 references.\n",
                 result->expr, result);
@@ -305,41 +552,9 @@ ShadowValue* executeChannelShadowOp(ShadowOpInfo* opinfo,
       VG_(printf)(")\n");
     }
   }
-  if (compensation_detection && !no_reals){
-    switch((int)opinfo->op_code){
-    case Iop_Add32F0x4:
-    case Iop_Add64F0x2:
-    case Iop_AddF64:
-    case Iop_AddF32:
-      if (getDouble(args[0]->real) == 0){
-        ULong inputError = ulpd(getDouble(args[1]->real), clientArgs[1]);
-        ULong outputError = ulpd(getDouble(result->real), clientResult);
-        if (outputError <= inputError){
-          result->influences = cloneInfluences(args[1]->influences);
-          return result;
-        }
-      }
-      // Intentional overflow to the next set of cases: both adds and
-      // subtracts are considered compensating if their second
-      // argument is zero in the reals (and the error decreases), but
-      // only adds also are compensating if their first argument is
-      // zero in the reals.
-    case Iop_Sub32F0x4:
-    case Iop_Sub64F0x2:
-    case Iop_SubF64:
-    case Iop_SubF32:
-      if (getDouble(args[1]->real) == 0){
-        ULong inputError = ulpd(getDouble(args[0]->real), clientArgs[0]);
-        ULong outputError = ulpd(getDouble(result->real), clientResult);
-        if (outputError <= inputError){
-          result->influences = cloneInfluences(args[0]->influences);
-          return result;
-        }
-      }
-      break;
-    default:
-      break;
-    }
+  if (compensation_detection && !no_reals &&
+      propagateCompensation(opinfo, result, args, clientArgs, clientResult)){
+    return result;
   }
   execInfluencesOp(opinfo, &(result->influences), args,
                    bitsLocalError >= error_threshold);
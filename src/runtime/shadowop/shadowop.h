@@ -36,12 +36,38 @@
 #include "../value-shadowstate/shadowval.h"
 #include "../op-shadowstate/shadowop-info.h"
 
+// Work out the plan for an instance of an operation, at instrument
+// time.
+void initShadowOpPlan(ShadowOpPlan* plan, ShadowOpInfo* opInfo);
 VG_REGPARM(1) ShadowTemp* executeShadowOp(ShadowOpInfoInstance* instance);
+
+// A run of operations in a block, executed all at once by
+// executeOpBatch with --batch-ops. The client values of the i'th
+// operation are in opBatchSlots[i], and its result goes in temp
+// dests[i].
+typedef struct _OpBatch {
+  int numOps;
+  ShadowOpInfoInstance** instances;
+  IRTemp* dests;
+} OpBatch;
+VG_REGPARM(1) void executeOpBatch(OpBatch* batch);
+// With --stats=yes, how many ops each batch ran on average.
+void printOpBatchStats(void);
 ShadowTemp* getArg(int argIdx, IROp op, IRTemp argTemp);
+// Get the value of a float block of an argument, making one from the
+// client value if it's unshadowed.
+ShadowValue* getArgValue(ShadowTemp* arg, int argIdx, IROp op, int block);
 ShadowValue* executeChannelShadowOp(ShadowOpInfo* opinfo,
+                                    const ShadowOpPlan* plan,
                                     ShadowValue** args,
                                     double* computedArgs,
                                     double computedResult);
+// With --lazy-reals, measure the error of an execution that
+// executeChannelShadowOp deferred, once its real has been computed,
+// and redo its influences now that its arguments' are final.
+void measureDeferredOp(ShadowOpInfo* opinfo, ShadowValue* result,
+                       ShadowValue** args, double* clientArgs,
+                       double clientResult);
 
 FloatBlocks numOpArgBlocks(IROp_Extended op);
 FloatBlocks numOpBlocks(IROp_Extended op);
@@ -39,7 +39,7 @@
 
 void execSymbolicOp(ShadowOpInfo* opinfo, ConcExpr** result,
                     double computedResult, ShadowValue** args,
-                    Bool problematic){
+                    Bool problematic, Bool erroneous){
   if (no_exprs){
     return;
   }
@@ -50,12 +50,49 @@ void execSymbolicOp(ShadowOpInfo* opinfo, ConcExpr** result,
   }
   *result = mkBranchConcExpr(computedResult, opinfo,
                              nargs, exprArgs);
-  generalizeSymbolicExpr(&(opinfo->expr), *result);
+  // With --lazy-exprs, sites don't get a symbolic expression until
+  // they've had some error. We still need the concrete expression
+  // either way, since a later erroneous operation might be built on
+  // top of this one.
+  if (lazy_exprs && opinfo->expr == NULL && !erroneous){
+    return;
+  }
+  if (expr_converge_threshold == 0){
+    generalizeSymbolicExpr(&(opinfo->expr), *result);
+  } else if (opinfo->stable_merges >= expr_converge_threshold &&
+             symbExprStillMatches(opinfo->expr, *result)){
+    // The expression has converged, and this execution wouldn't
+    // change it, so there's nothing to generalize.
+  } else {
+    UWord oldSignature = symbExprSignature(opinfo->expr);
+    generalizeSymbolicExpr(&(opinfo->expr), *result);
+    if (symbExprSignature(opinfo->expr) == oldSignature){
+      opinfo->stable_merges++;
+    } else {
+      opinfo->stable_merges = 0;
+    }
+  }
   if (problematic){
     updateProblematicRanges(opinfo->expr, *result);
   }
 }
 
+void flagSymbolicOp(ShadowOpInfo* opinfo, ConcExpr* cexpr,
+                    Bool problematic, Bool erroneous){
+  if (no_exprs){
+    return;
+  }
+  if (lazy_exprs && opinfo->expr == NULL){
+    if (!erroneous){
+      return;
+    }
+    generalizeSymbolicExpr(&(opinfo->expr), cexpr);
+  }
+  if (problematic){
+    updateProblematicRanges(opinfo->expr, cexpr);
+  }
+}
+
 void generalizeSymbolicExpr(SymbExpr** symbexpr, ConcExpr* cexpr){
   if (*symbexpr == NULL){
     *symbexpr = concreteToSymbolic(cexpr);
@@ -68,13 +105,13 @@ void generalizeSymbolicExpr(SymbExpr** symbexpr, ConcExpr* cexpr){
     if (print_expr_updates){
       VG_(printf)("Merging %p (op %p) ", *symbexpr, (*symbexpr)->branch.op);
       ppSymbExpr(*symbexpr);
-      VG_(printf)(" with %p (op %p) ", cexpr, cexpr->branch.op);
+      VG_(printf)(" with %p (op %p) ", cexpr, concExprOp(cexpr));
       ppConcExpr(cexpr);
       VG_(printf)("\n");
     }
     if ((*symbexpr)->type == Node_Branch &&
         (cexpr->type == Node_Leaf ||
-         cexpr->branch.op != (*symbexpr)->branch.op)){
+         cexpr->branch.op_id != (*symbexpr)->branch.op->id)){
       (*symbexpr) =
         mkFreshSymbolicLeaf((*symbexpr)->isConst &&
                             (*symbexpr)->constVal == cexpr->value,
@@ -101,6 +138,123 @@ void generalizeSymbolicExpr(SymbExpr** symbexpr, ConcExpr* cexpr){
   }
 }
 
+UWord symbExprSignature(SymbExpr* expr){
+  if (expr == NULL){
+    return 0;
+  }
+  // Generalizing only touches the top GENERALIZE_DEPTH + 1 levels of
+  // the expression, and the equivalence groups of the root.
+  UWord hash = symbExprShapeHash(expr, GENERALIZE_DEPTH + 1);
+  if (expr->type == Node_Branch){
+    GroupList groups = expr->branch.groups;
+    hash = hash * 31 + groups->size;
+    for(int i = 0; i < groups->size; ++i){
+      for(Group member = groups->data[i]; member != NULL;
+          member = member->next){
+        hash = hash * 31 + (UWord)member->item;
+      }
+    }
+  }
+  return hash;
+}
+
+UWord symbExprShapeHash(SymbExpr* expr, int depth){
+  UWord hash = (UWord)expr;
+  hash = hash * 31 + expr->isConst;
+  hash = hash * 31 + hashValue(expr->constVal);
+  if (expr->type == Node_Branch && depth > 1){
+    for(int i = 0; i < expr->branch.nargs; ++i){
+      hash = hash * 31 +
+        symbExprShapeHash(expr->branch.args[i], depth - 1);
+    }
+  }
+  return hash;
+}
+
+// Whether generalizing a constant node with this value would leave
+// it alone. This mirrors the constant handling in
+// generalizeSymbolicExpr and generalizeStructure.
+static Bool constStillMatches(SymbExpr* symbExpr, double value){
+  if (!symbExpr->isConst){
+    return True;
+  }
+  if (symbExpr->constVal != symbExpr->constVal){
+    return value != value;
+  }
+  return symbExpr->constVal == value || value != value;
+}
+
+static Bool structureStillMatches(SymbExpr* symbExpr, ConcExpr* concExpr,
+                                  int depth){
+  if (depth == 0){
+    return True;
+  }
+  if (!constStillMatches(symbExpr, concExpr->value)){
+    return False;
+  }
+  if (symbExpr->type == Node_Leaf){
+    return True;
+  }
+  for(int i = 0; i < symbExpr->branch.nargs; ++i){
+    SymbExpr* symbChild = symbExpr->branch.args[i];
+    ConcExpr* concChild = concExprArg(concExpr, i);
+    if (symbChild->type == Node_Branch &&
+        (concChild->type == Node_Leaf ||
+         concChild->branch.op_id != symbChild->branch.op->id)){
+      return False;
+    }
+    if (!structureStillMatches(symbChild, concChild, depth - 1)){
+      return False;
+    }
+  }
+  return True;
+}
+
+Bool symbExprStillMatches(SymbExpr* symbExpr, ConcExpr* cexpr){
+  if (symbExpr == NULL){
+    return False;
+  }
+  if (symbExpr->type == Node_Branch &&
+      (cexpr->type == Node_Leaf ||
+       cexpr->branch.op_id != symbExpr->branch.op->id)){
+    return False;
+  }
+  if (!structureStillMatches(symbExpr, cexpr, GENERALIZE_DEPTH)){
+    return False;
+  }
+  if (symbExpr->type == Node_Leaf){
+    return True;
+  }
+  return equalitiesStillHold(symbExpr, cexpr);
+}
+
+Bool equalitiesStillHold(SymbExpr* symbExpr, ConcExpr* cexpr){
+  // Intersecting the equalities would only change a group if some of
+  // its members don't exist anymore, or don't all have the same value.
+  GroupList groups = symbExpr->branch.groups;
+  for(int i = 0; i < groups->size; ++i){
+    Group group = groups->data[i];
+    if (group == NULL){
+      continue;
+    }
+    ConcExpr* canonical = concExprPosGet(cexpr, group->item);
+    if (canonical == NULL){
+      return False;
+    }
+    for(Group member = group; member != NULL; member = member->next){
+      if (symbExprPosGet(symbExpr, member->item) == NULL){
+        return False;
+      }
+      ConcExpr* memberNode = concExprPosGet(cexpr, member->item);
+      if (memberNode == NULL ||
+          !NaNSafeEquals(memberNode->value, canonical->value)){
+        return False;
+      }
+    }
+  }
+  return True;
+}
+
 void addValEntry(VgHashTable* valmap, double val, int groupIdx){
   ValMapEntry* entry = VG_(malloc)("val map entry", sizeof(ValMapEntry));
   entry->valHash = hashValue(val);
@@ -151,14 +305,14 @@ void generalizeStructure(SymbExpr* symbExpr, ConcExpr* concExpr,
 
   tl_assert(symbExpr->type == Node_Branch);
   tl_assert(concExpr->type == Node_Branch);
-  tl_assert(symbExpr->branch.nargs == concExpr->branch.nargs);
+  tl_assert(symbExpr->branch.nargs == concExpr->nargs);
   for(int i = 0; i < symbExpr->branch.nargs; ++i){
     SymbExpr* symbChild = symbExpr->branch.args[i];
-    ConcExpr* concChild = concExpr->branch.args[i];
+    ConcExpr* concChild = concExprArg(concExpr, i);
 
     if (symbChild->type == Node_Branch){
       if (concChild->type == Node_Leaf ||
-          concChild->branch.op != symbChild->branch.op){
+          concChild->branch.op_id != symbChild->branch.op->id){
         symbExpr->branch.args[i] =
           mkFreshSymbolicLeaf(symbChild->isConst, symbChild->constVal);
         symbChild = symbExpr->branch.args[i];
@@ -174,6 +328,11 @@ void generalizeStructure(SymbExpr* symbExpr, ConcExpr* concExpr,
 void intersectEqualities(SymbExpr* symbExpr, ConcExpr* concExpr){
   tl_assert(concExpr->type == Node_Branch);
   tl_assert(symbExpr->type == Node_Branch);
+  // Usually nothing splits, so check for that first, without
+  // building anything.
+  if (equalitiesStillHold(symbExpr, concExpr)){
+    return;
+  }
   GroupList groups = symbExpr->branch.groups;
   GroupList newGroups = mkXA(GroupList)();
   for(int i = 0; i < groups->size; i++){
@@ -182,7 +341,12 @@ void intersectEqualities(SymbExpr* symbExpr, ConcExpr* concExpr){
     Group newCurGroup = NULL;
 
     double canonicalValue = 0.0;
-    VgHashTable* splitMap = NULL;
+    // The values that members have split off with so far, and the
+    // groups they went into. A group can't split more ways than it
+    // has members, so these never need to grow.
+    double* splitVals = NULL;
+    int* splitGroups = NULL;
+    int numSplits = 0;
 
     while(curGroup != NULL){
       NodePos groupMemberPos = lpop(Group)(&curGroup);
@@ -200,6 +364,7 @@ void intersectEqualities(SymbExpr* symbExpr, ConcExpr* concExpr){
                               curGroup->item,
                               lookupExampleInput(symbExpr->branch.exampleProblematicArgs,
                                                  canonicalPos));
+          symbExpr->branch.rangeSlotsStale = True;
           canonicalPos = curGroup->item;
         }
         continue;
@@ -210,14 +375,26 @@ void intersectEqualities(SymbExpr* symbExpr, ConcExpr* concExpr){
         lpush(Group)(&(newCurGroup), groupMemberPos);
       } else {
         if (!NaNSafeEquals(nodeValue, canonicalValue)){
-          if (splitMap == NULL){
-            splitMap = VG_(HT_construct)("split map.\n");
+          int splitGroup = -1;
+          for(int j = 0; j < numSplits; ++j){
+            if (NaNSafeEquals(splitVals[j], nodeValue)){
+              splitGroup = splitGroups[j];
+              break;
+            }
           }
-          int splitGroup = lookupVal(splitMap, nodeValue);
           if (splitGroup == -1){
+            if (splitVals == NULL){
+              int maxSplits = length(Group)(&curGroup) + 1;
+              splitVals = VG_(malloc)("split values",
+                                      sizeof(double) * maxSplits);
+              splitGroups = VG_(malloc)("split groups",
+                                        sizeof(int) * maxSplits);
+            }
+            splitVals[numSplits] = nodeValue;
+            splitGroups[numSplits] = newGroups->size;
+            numSplits++;
             Group newSplitGroup = NULL;
             lpush(Group)(&newSplitGroup, groupMemberPos);
-            addValEntry(splitMap, nodeValue, newGroups->size);
             XApush(GroupList)(newGroups, newSplitGroup);
             RangeRecord* existingRange =
               lookupRangeRecord(symbExpr->branch.varProblematicRanges,
@@ -231,6 +408,7 @@ void intersectEqualities(SymbExpr* symbExpr, ConcExpr* concExpr){
                                 lookupExampleInput(symbExpr->branch
                                                    .exampleProblematicArgs,
                                                    canonicalPos));
+            symbExpr->branch.rangeSlotsStale = True;
           } else {
             lpush(Group)(&(newGroups->data[splitGroup]), groupMemberPos);
           }
@@ -239,8 +417,9 @@ void intersectEqualities(SymbExpr* symbExpr, ConcExpr* concExpr){
         }
       }
     }
-    if (splitMap != NULL){
-      VG_(HT_destruct)(splitMap, VG_(free));
+    if (splitVals != NULL){
+      VG_(free)(splitVals);
+      VG_(free)(splitGroups);
     }
     XApush(GroupList)(newGroups, newCurGroup);
   }
@@ -256,9 +435,9 @@ void getGrouped(GroupList groupList, VgHashTable* valMap,
                 NodePos curPos, int maxDepth){
   tl_assert(symbExpr->type == Node_Branch);
   tl_assert(concExpr->type == Node_Branch);
-  tl_assert(symbExpr->branch.nargs == concExpr->branch.nargs);
-  for(int i = 0; i < concExpr->branch.nargs; ++i){
-    ConcExpr* concChild = concExpr->branch.args[i];
+  tl_assert(symbExpr->branch.nargs == concExpr->nargs);
+  for(int i = 0; i < concExpr->nargs; ++i){
+    ConcExpr* concChild = concExprArg(concExpr, i);
     SymbExpr* symbChild = symbExpr->branch.args[i];
     NodePos newPos = rconsPos(curPos, i);
     double value = concChild->value;
@@ -279,7 +458,7 @@ void getGrouped(GroupList groupList, VgHashTable* valMap,
 
     if (concChild->type == Node_Branch &&
         symbChild->type == Node_Branch &&
-        concChild->branch.op == symbChild->branch.op){
+        concChild->branch.op_id == symbChild->branch.op->id){
       if (maxDepth > 1){
         getGrouped(groupList, valMap, concChild, symbChild, newPos, maxDepth - 1);
       } else {
@@ -431,10 +610,11 @@ ConcExpr* concExprPosGet(ConcExpr* expr, NodePos pos){
     if (curExpr->type == Node_Leaf){
       return NULL;
     }
-    if (curExpr->branch.nargs <= pos->data[i]){
+    int step = pos->data[i];
+    if (curExpr->nargs <= step){
       return NULL;
     }
-    curExpr = curExpr->branch.args[pos->data[i]];
+    curExpr = concExprArg(curExpr, step);
   }
   return curExpr;
 }
@@ -444,10 +624,11 @@ SymbExpr* symbExprPosGet(SymbExpr* expr, NodePos pos){
     if (curExpr->type == Node_Leaf){
       return NULL;
     }
-    if (curExpr->branch.nargs <= pos->data[i]){
+    int step = pos->data[i];
+    if (curExpr->branch.nargs <= step){
       return NULL;
     }
-    curExpr = curExpr->branch.args[pos->data[i]];
+    curExpr = curExpr->branch.args[step];
   }
   return curExpr;
 }
@@ -457,24 +638,18 @@ SymbExpr** symbExprPosGetRef(SymbExpr** expr, NodePos pos){
     if ((*curExpr)->type == Node_Leaf){
       return NULL;
     }
-    if ((*curExpr)->branch.nargs <= pos->data[i]){
+    int step = pos->data[i];
+    if ((*curExpr)->branch.nargs <= step){
       return NULL;
     }
-    curExpr = &((*curExpr)->branch.args[pos->data[i]]);
+    curExpr = &((*curExpr)->branch.args[step]);
   }
   return curExpr;
 }
 
+// Positions are interned, so the same path is always the same node.
 Word cmp_position(const void* node1, const void* node2){
   const VarMapEntry* entry1 = (const VarMapEntry*)node1;
   const VarMapEntry* entry2 = (const VarMapEntry*)node2;
-  if (entry1->position->len != entry2->position->len){
-    return 1;
-  }
-  for(SizeT i = 0; i < entry1->position->len; ++i){
-    if (entry1->position->data[i] != entry2->position->data[i]){
-      return 1;
-    }
-  }
-  return 0;
+  return entry1->position == entry2->position ? 0 : 1;
 }
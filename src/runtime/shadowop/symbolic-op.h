@@ -65,10 +65,27 @@ typedef struct _exampleMapEntry {
   double value;
 } ExampleMapEntry;
 
+// Problematic means the result has more than --error-threshold bits
+// of global error, erroneous that it has that much global error or
+// enough local error to count as an influence.
 void execSymbolicOp(ShadowOpInfo* opinfo, ConcExpr** result,
                     double computedResult, ShadowValue** args,
-                    Bool problematic);
+                    Bool problematic, Bool erroneous);
+// For an execution whose error wasn't known until after
+// execSymbolicOp was run on it with both flags false (with
+// --lazy-reals), do the rest of what it would have done.
+void flagSymbolicOp(ShadowOpInfo* opinfo, ConcExpr* cexpr,
+                    Bool problematic, Bool erroneous);
 void generalizeSymbolicExpr(SymbExpr** symexpr, ConcExpr* cexpr);
+// A hash of everything about an expression that generalizing it
+// could change, for noticing when a site's expression stops changing.
+UWord symbExprSignature(SymbExpr* expr);
+UWord symbExprShapeHash(SymbExpr* expr, int depth);
+// Whether generalizing the expression with cexpr would leave it
+// exactly as it is. Much cheaper than generalizing, since it doesn't
+// build anything.
+Bool symbExprStillMatches(SymbExpr* symbExpr, ConcExpr* cexpr);
+Bool equalitiesStillHold(SymbExpr* symbExpr, ConcExpr* cexpr);
 
 void generalizeStructure(SymbExpr* symbexpr, ConcExpr* concExpr,
                          int depth);
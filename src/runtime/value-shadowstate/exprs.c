@@ -42,8 +42,12 @@
 #include <math.h>
 #include <inttypes.h>
 
-Stack* leafCExprs;
-Stack* branchCExprs[MAX_BRANCH_ARGS];
+ConcExpr* cexprChunks[MAX_CEXPR_CHUNKS];
+static UInt numCExprChunks = 0;
+// The next never-used index, and the head of the list of nodes that
+// have been freed.
+static ConcExprIdx nextFreshCExpr = 0;
+static ConcExprIdx freeCExprs = 0;
 Xarray_H(Stack*, StackArray);
 Xarray_Impl(Stack*, StackArray);
 Xarray_H(char*, VarList);
@@ -58,54 +62,132 @@ VarList extraVars;
 List_Impl(NodePos, Group);
 Xarray_Impl(Group, GroupList);
 void initExprAllocator(void){
-  leafCExprs = mkStack();
-  for(int i = 0; i < MAX_BRANCH_ARGS; ++i){
-    branchCExprs[i] = mkStack();
-  }
   extraVars = mkXA(VarList)();
   initializePositionTree();
 }
-VG_REGPARM(1) void freeBranchConcExpr(ConcExpr* expr){
-  stack_push(branchCExprs[expr->branch.nargs - 1], (void*)expr);
+static ConcExpr* allocConcExpr(void){
+  if (freeCExprs != 0){
+    ConcExpr* result = concExprAt(freeCExprs);
+    freeCExprs = result->branch.args[0];
+    return result;
+  }
+  if ((nextFreshCExpr >> CEXPR_CHUNK_BITS) == numCExprChunks){
+    tl_assert2(numCExprChunks < MAX_CEXPR_CHUNKS,
+               "Ran out of room for expressions!\n");
+    cexprChunks[numCExprChunks++] =
+      VG_(perm_malloc)(sizeof(ConcExpr) * CEXPR_CHUNK_SIZE,
+                       vg_alignof(ConcExpr));
+    // Skip index zero, so that it can mean "no node".
+    if (nextFreshCExpr == 0){
+      nextFreshCExpr = 1;
+    }
+  }
+  ConcExpr* result = concExprAt(nextFreshCExpr);
+  result->idx = nextFreshCExpr++;
+  return result;
 }
-void recursivelyDisownConcExpr(ConcExpr* expr, int depth){
-  if (depth == 0) return;
-  tl_assert2(expr->ref_count > 0,
-             "The ref count of %p is already zero, and we're trying to decrease it!\n",
-             expr);
-  if (print_expr_refs){
-    VG_(printf)("Decreasing ref count of expr %p from %d to %d\n",
-                expr, expr->ref_count, expr->ref_count - 1);
+static void freeConcExpr(ConcExpr* expr){
+  expr->branch.args[0] = freeCExprs;
+  freeCExprs = expr->idx;
+}
+
+// Concrete expressions are kept alive to a bounded depth below
+// anything a shadow value holds. Rather than every shadow value
+// owning that whole window itself, shadow values only count
+// themselves in value_refs on the node they hold, which makes
+// copying and freeing them constant time. The window is owned once
+// by the node, from when it's made until the last shadow value
+// holding it goes away, and counted in the ref_count of each node in
+// it. A node is freed when both of its counts are zero.
+
+// --max-expr-block-depth is at most 100, and windows are twice that
+// deep. Since every node on the walk stack that isn't a leaf of the
+// walk gets replaced by at most MAX_BRANCH_ARGS children one level
+// down, the stack never holds more than (MAX_BRANCH_ARGS - 1) * depth
+// nodes.
+#define MAX_OWNERSHIP_DEPTH 200
+#define OWNERSHIP_STACK_SIZE \
+  ((MAX_BRANCH_ARGS - 1) * MAX_OWNERSHIP_DEPTH + 1)
+static ConcExprIdx walkNodes[OWNERSHIP_STACK_SIZE];
+static int walkDepths[OWNERSHIP_STACK_SIZE];
+
+// Add delta to the ref count of every node strictly below expr, down
+// to the window depth.
+static void adjustWindow(ConcExpr* expr, int delta){
+  int depth = max_expr_block_depth * 2;
+  tl_assert(depth <= MAX_OWNERSHIP_DEPTH);
+  if (expr->type == Node_Leaf || depth < 2) return;
+  int top = 0;
+  for(int i = expr->nargs - 1; i >= 0; --i){
+    walkNodes[top] = expr->branch.args[i];
+    walkDepths[top] = depth - 1;
+    top++;
   }
-  (expr->ref_count)--;
-  if (expr->ref_count == 0){
+  while(top > 0){
+    top--;
+    ConcExpr* node = concExprAt(walkNodes[top]);
+    int nodeDepth = walkDepths[top];
+    tl_assert2(delta > 0 || node->ref_count > 0,
+               "The ref count of %p is already zero, and we're trying to decrease it!\n",
+               node);
     if (print_expr_refs){
-      VG_(printf)("No references left for expr %p! Freeing...\n", expr);
+      VG_(printf)("Changing ref count of expr %p from %d to %d\n",
+                  node, node->ref_count, node->ref_count + delta);
     }
-    if (expr->type == Node_Leaf){
-      stack_push(leafCExprs, (void*)expr);
-    } else {
-      freeBranchConcExpr(expr);
+    // Queue up the children before we possibly free the node, since
+    // freeing it reuses its first argument slot.
+    if (node->type == Node_Branch && nodeDepth > 1){
+      for(int i = node->nargs - 1; i >= 0; --i){
+        walkNodes[top] = node->branch.args[i];
+        walkDepths[top] = nodeDepth - 1;
+        top++;
+      }
     }
-  }
-  if (expr->type == Node_Branch){
-    for(int i = 0; i < expr->branch.nargs; ++i){
-      recursivelyDisownConcExpr(expr->branch.args[i], depth - 1);
+    node->ref_count += delta;
+    if (node->ref_count == 0 && node->value_refs == 0){
+      if (print_expr_refs){
+        VG_(printf)("No references left for expr %p! Freeing...\n", node);
+      }
+      freeConcExpr(node);
     }
   }
 }
+
+void ownConcExpr(ConcExpr* expr){
+  if (print_expr_refs){
+    VG_(printf)("Increasing value refs of expr %p from %d to %d\n",
+                expr, expr->value_refs, expr->value_refs + 1);
+  }
+  tl_assert(expr->value_refs > 0);
+  tl_assert2(expr->value_refs < MAX_CEXPR_VALUE_REFS,
+             "Too many shadow values hold expr %p!\n", expr);
+  expr->value_refs++;
+}
 void disownConcExpr(ConcExpr* expr){
-  recursivelyDisownConcExpr(expr, max_expr_block_depth * 2);
+  tl_assert2(expr->value_refs > 0,
+             "The value refs of %p are already zero, and we're trying to decrease them!\n",
+             expr);
+  if (print_expr_refs){
+    VG_(printf)("Decreasing value refs of expr %p from %d to %d\n",
+                expr, expr->value_refs, expr->value_refs - 1);
+  }
+  expr->value_refs--;
+  if (expr->value_refs == 0){
+    adjustWindow(expr, -1);
+    if (expr->ref_count == 0){
+      if (print_expr_refs){
+        VG_(printf)("No references left for expr %p! Freeing...\n", expr);
+      }
+      freeConcExpr(expr);
+    }
+  }
 }
 ConcExpr* mkLeafConcExpr(double value){
-  ConcExpr* result;
-  if (stack_empty(leafCExprs)){
-    result = VG_(malloc)("expr", sizeof(ConcExpr));
-    result->type = Node_Leaf;
-  } else {
-    result = (void*)stack_pop(leafCExprs);
-  }
-  result->ref_count = 1;
+  ConcExpr* result = allocConcExpr();
+  result->type = Node_Leaf;
+  result->nargs = 0;
+  result->ref_count = 0;
+  result->value_refs = 1;
   if (print_expr_refs){
     VG_(printf)("Making new expression %p with 1 reference\n", result);
   }
@@ -114,48 +196,25 @@ ConcExpr* mkLeafConcExpr(double value){
   return result;
 }
 
-void recursivelyOwnConcExpr(ConcExpr* expr, int depth){
-  if (depth == 0) return;
-  if (print_expr_refs){
-    VG_(printf)("Increasing ref count of expr %p from %d to %d\n",
-                expr, expr->ref_count, expr->ref_count + 1);
-  }
-  (expr->ref_count)++;
-  if (expr->type == Node_Branch){
-    for(int i = 0; i < expr->branch.nargs; ++i){
-      tl_assert(expr->branch.args[i] != NULL);
-      recursivelyOwnConcExpr(expr->branch.args[i], depth - 1);
-    }
-  }
-}
-
 ConcExpr* mkBranchConcExpr(double value, ShadowOpInfo* op,
                            int nargs, ConcExpr** args){
-  ConcExpr* result;
-  if (stack_empty(branchCExprs[nargs-1])){
-    result = VG_(malloc)("expr", sizeof(ConcExpr));
-    result->branch.args = VG_(perm_malloc)(sizeof(ConcExpr*) * nargs,
-                                           vg_alignof(ConcExpr*));
-    result->branch.nargs = nargs;
-    result->type = Node_Branch;
-  } else {
-    result = (void*)stack_pop(branchCExprs[nargs-1]);
-  }
-  // We'll do ownership stuff at the end, leave it at 0 refs for now.
+  tl_assert(nargs > 0 && nargs <= MAX_BRANCH_ARGS);
+  ConcExpr* result = allocConcExpr();
+  result->type = Node_Branch;
+  result->nargs = nargs;
   if (print_expr_refs){
-    VG_(printf)("Making new expression %p with 0 references\n", result);
+    VG_(printf)("Making new expression %p with 1 reference\n", result);
   }
   result->ref_count = 0;
+  result->value_refs = 1;
   result->value = value;
-  result->branch.op = op;
+  result->branch.op_id = op->id;
 
   for(int i = 0; i < nargs; ++i){
-    tl_assert(i < result->branch.nargs);
-    tl_assert(result->branch.nargs > i);
-    result->branch.args[i] = args[i];
+    result->branch.args[i] = args[i]->idx;
   }
 
-  recursivelyOwnConcExpr(result, max_expr_block_depth * 2);
+  adjustWindow(result, 1);
   return result;
 }
 
@@ -170,7 +229,13 @@ SymbExpr* mkFreshSymbolicLeaf(Bool isConst, double constVal){
   return result;
 }
 
+static SymbExpr* concreteToSymbolicBounded(ConcExpr* cexpr, int depth);
 SymbExpr* concreteToSymbolic(ConcExpr* cexpr){
+  // Only nodes within this many levels of an owned expression are
+  // guaranteed to still be around.
+  return concreteToSymbolicBounded(cexpr, max_expr_block_depth * 2);
+}
+static SymbExpr* concreteToSymbolicBounded(ConcExpr* cexpr, int depth){
   // This is only necessarily sound if you are updating expr trees
   // with every operation, not if you only pick some, like the
   // erroneous operations. Because, you might be going down your tree,
@@ -178,15 +243,15 @@ SymbExpr* concreteToSymbolic(ConcExpr* cexpr){
   // mismatches your concrete expression farther down, because it
   // wasn't updated recently.
   if (cexpr->type == Node_Branch &&
-      cexpr->branch.op->expr != NULL){
-    SymbExpr* existingExpr = cexpr->branch.op->expr;
+      concExprOp(cexpr)->expr != NULL){
+    SymbExpr* existingExpr = concExprOp(cexpr)->expr;
     return existingExpr;
   }
 
   SymbExpr* result = VG_(perm_malloc)(sizeof(SymbExpr),
                                       vg_alignof(SymbExpr));
   if (cexpr->type == Node_Branch){
-    cexpr->branch.op->expr = result;
+    concExprOp(cexpr)->expr = result;
   }
 
   if (cexpr->type == Node_Leaf){
@@ -195,26 +260,39 @@ SymbExpr* concreteToSymbolic(ConcExpr* cexpr){
     result->isConst = True;
     result->constVal = cexpr->value;
     result->type = Node_Branch;
-    result->branch.op = cexpr->branch.op;
+    result->branch.op = concExprOp(cexpr);
     tl_assert2(result->branch.op->op_code == 0 ||
                (result->branch.op->op_code > IEop_INVALID &&
                 result->branch.op->op_code < IEop_REALLY_LAST_FOR_REAL_GUYS),
                "Bad IR Op %d on op %p",
                result->branch.op->op_code);
-    result->branch.nargs = cexpr->branch.nargs;
+    result->branch.nargs = cexpr->nargs;
     result->branch.args =
-      VG_(perm_malloc)(sizeof(SymbExpr*) * cexpr->branch.nargs,
+      VG_(perm_malloc)(sizeof(SymbExpr*) * cexpr->nargs,
                        vg_alignof(SymbExpr*));
-    for(int i = 0; i < cexpr->branch.nargs; ++i){
-      tl_assert(i < cexpr->branch.nargs);
-      ConcExpr* arg = cexpr->branch.args[i];
+    for(int i = 0; i < cexpr->nargs; ++i){
+      tl_assert(i < cexpr->nargs);
+      ConcExpr* arg = concExprArg(cexpr, i);
       if (arg->type == Node_Leaf){
         tl_assert(i < result->branch.nargs);
         result->branch.args[i] = mkFreshSymbolicLeaf(True, arg->value);
-      } else {
-        tl_assert(arg->branch.op->expr != NULL);
+      } else if (concExprOp(arg)->expr != NULL){
         tl_assert(i < result->branch.nargs);
-        result->branch.args[i] = arg->branch.op->expr;
+        result->branch.args[i] = concExprOp(arg)->expr;
+      } else {
+        // With --lazy-exprs, the site that made this argument might
+        // not have been tracking its expression yet, so start it
+        // tracking from here. Building it groups its variables by
+        // looking max_expr_block_depth levels further down, so once
+        // that would reach past the nodes we can still trust, just
+        // make it a variable.
+        tl_assert(lazy_exprs);
+        if (depth - 1 > max_expr_block_depth){
+          result->branch.args[i] =
+            concreteToSymbolicBounded(arg, depth - 1);
+        } else {
+          result->branch.args[i] = mkFreshSymbolicLeaf(False, arg->value);
+        }
       }
     }
     result->branch.groups = getExprsEquivGroups(cexpr, result);
@@ -235,19 +313,9 @@ int hasRepeatedVars(SymbExpr* expr){
 int isUnderneathGroupMember(NodePos position, Group group);
 int isUnderneathGroupMember(NodePos position, Group group){
   for(Group curNode = group; curNode != NULL; curNode = curNode->next){
-    NodePos memberPosition = curNode->item;
-    if (position->len <= memberPosition->len) continue;
-    int isUnderneath = 1;
-    for(int i = 0; i < memberPosition->len; ++i){
-      if (position->data[i] != memberPosition->data[i]){
-        isUnderneath = 0;
-        break;
-      }
-    }
-    if (!isUnderneath) {
-      continue;
+    if (posIsUnder(position, curNode->item)){
+      return 1;
     }
-    return 1;
   }
   return 0;
 }
@@ -395,6 +463,9 @@ void initializeProblematicRangesAndExample(SymbExpr* symbExpr){
     VG_(HT_construct)("Variable problematic ranges table");
   symbExpr->branch.exampleProblematicArgs =
     VG_(HT_construct)("example problematic inputs array");
+  symbExpr->branch.rangeSlots = NULL;
+  symbExpr->branch.numRangeSlots = 0;
+  symbExpr->branch.rangeSlotsStale = True;
 
   // Part (a)
 
@@ -503,65 +574,88 @@ void addInitialExampleEntry(VgHashTable* exampleTable, NodePos position){
   VG_(HT_add_node)(exampleTable, newEntry);
 }
 
-List_H(RangeMapEntry*, RangeEntryList);
-List_Impl(RangeMapEntry*, RangeEntryList);
-
-void updateProblematicRanges(SymbExpr* symbExpr, ConcExpr* cexpr){
+void rebuildRangeSlots(SymbExpr* symbExpr){
   VgHashTable* rangeTable = symbExpr->branch.varProblematicRanges;
   VgHashTable* exampleTable = symbExpr->branch.exampleProblematicArgs;
-  RangeEntryList expiredEntries = NULL;
-
-  {
-    VG_(HT_ResetIter)(rangeTable);
-    RangeMapEntry* entry;
-    while((entry = VG_(HT_Next)(rangeTable)) != NULL){
-      ConcExpr* sampleConcNode = concExprPosGet(cexpr, entry->position);
-      // The node mentioned by this table entry might not exist in the
-      // concrete expression we're generalizing with, in which case it
-      // won't exist anymore in the symbolic expression either. If
-      // that's the case, we'll remove it from the range table so that
-      // we don't bother trying to maintain it later.
-      if (sampleConcNode == NULL){
-        // Unfortunately, we can't remove the node directly from the
-        // table since that would violate the iterator invariants, so
-        // we'll just add it to a stack to be removed at the end of the
-        // update.
-        lpush(RangeEntryList)(&expiredEntries, entry);
-      } else {
-        // If the node DOES exist, we should update the range table entry.
-        updateRangeRecord(&(entry->range_rec), sampleConcNode->value);
-      }
+  if (symbExpr->branch.rangeSlots != NULL){
+    VG_(free)(symbExpr->branch.rangeSlots);
+  }
+  symbExpr->branch.rangeSlots =
+    VG_(malloc)("range slots",
+                sizeof(RangeSlot) * (VG_(HT_count_nodes)(rangeTable) + 1));
+  int numSlots = 0;
+  Bool complete = True;
+  VG_(HT_ResetIter)(rangeTable);
+  RangeMapEntry* entry;
+  while((entry = VG_(HT_Next)(rangeTable)) != NULL){
+    ExampleMapEntry key = {.position = entry->position,
+                           .positionHash = entry->positionHash};
+    ExampleMapEntry* exampleEntry =
+      VG_(HT_gen_lookup)(exampleTable, &key, cmp_position);
+    tl_assert(exampleEntry != NULL);
+    RangeSlot* slot = &(symbExpr->branch.rangeSlots[numSlots++]);
+    slot->position = entry->position;
+    slot->range = &(entry->range_rec);
+    slot->example = &(exampleEntry->value);
+    if (exampleEntry->value != exampleEntry->value){
+      complete = False;
     }
   }
-  // Remove all the expired entries.
-  while(length(RangeEntryList)(&expiredEntries) > 0){
-    RangeMapEntry* expiredEntry = lpop(RangeEntryList)(&expiredEntries);
-    VG_(HT_gen_remove)(rangeTable, expiredEntry, cmp_position);
-    // This should work? Since gen_remove should only need to look at
-    // the position and positionHash of the entry, and those two
-    // things are the same across both RangeMapEntry and
-    // ExampleMapEntry.
-    VG_(HT_gen_remove)(exampleTable, expiredEntry, cmp_position);
+  symbExpr->branch.numRangeSlots = numSlots;
+  symbExpr->branch.exampleComplete = complete;
+  symbExpr->branch.rangeSlotsStale = False;
+}
+
+static void removeExpiredRangeSlots(SymbExpr* symbExpr, ConcExpr* cexpr){
+  for(int i = 0; i < symbExpr->branch.numRangeSlots; ++i){
+    NodePos position = symbExpr->branch.rangeSlots[i].position;
+    if (concExprPosGet(cexpr, position) != NULL){
+      continue;
+    }
+    RangeMapEntry key = {.position = position,
+                         .positionHash = hashPosition(position)};
+    VG_(free)(VG_(HT_gen_remove)(symbExpr->branch.varProblematicRanges,
+                                 &key, cmp_position));
+    // This works since gen_remove only looks at the position and
+    // positionHash of the key, and those are laid out the same in
+    // RangeMapEntry and ExampleMapEntry.
+    VG_(free)(VG_(HT_gen_remove)(symbExpr->branch.exampleProblematicArgs,
+                                 &key, cmp_position));
   }
-  // Now let's do the example problematic inputs
-  int exampleFullyInitialized = 1;
-  {
-    VG_(HT_ResetIter)(exampleTable);
-    ExampleMapEntry* entry;
-    while((entry = VG_(HT_Next)(exampleTable)) != NULL){
-      if (entry->value != entry->value){
-        exampleFullyInitialized = 0;
-        break;
-      }
+  rebuildRangeSlots(symbExpr);
+}
+
+void updateProblematicRanges(SymbExpr* symbExpr, ConcExpr* cexpr){
+  if (symbExpr->branch.rangeSlotsStale){
+    rebuildRangeSlots(symbExpr);
+  }
+  RangeSlot* slots = symbExpr->branch.rangeSlots;
+  for(int i = 0; i < symbExpr->branch.numRangeSlots; ++i){
+    ConcExpr* sampleConcNode = concExprPosGet(cexpr, slots[i].position);
+    // The node mentioned by this slot might not exist in the
+    // concrete expression we're generalizing with, in which case it
+    // won't exist anymore in the symbolic expression either. If
+    // that's the case, we'll remove it from the tables so that we
+    // don't bother trying to maintain it later. This is rare, so we
+    // don't mind redoing the whole update afterwards.
+    if (sampleConcNode == NULL){
+      removeExpiredRangeSlots(symbExpr, cexpr);
+      updateProblematicRanges(symbExpr, cexpr);
+      return;
     }
-    if (!exampleFullyInitialized){
-      VG_(HT_ResetIter)(exampleTable);
-      while((entry = VG_(HT_Next)(exampleTable)) != NULL){
-        ConcExpr* sampleConcNode = concExprPosGet(cexpr, entry->position);
-        tl_assert(sampleConcNode != NULL);
-        entry->value = sampleConcNode->value;
+    updateRangeRecord(slots[i].range, sampleConcNode->value);
+  }
+  // Now let's do the example problematic inputs
+  if (!symbExpr->branch.exampleComplete){
+    Bool complete = True;
+    for(int i = 0; i < symbExpr->branch.numRangeSlots; ++i){
+      double value = concExprPosGet(cexpr, slots[i].position)->value;
+      *(slots[i].example) = value;
+      if (value != value){
+        complete = False;
       }
     }
+    symbExpr->branch.exampleComplete = complete;
   }
 }
 
@@ -886,11 +980,11 @@ void ppConcExprBounded(ConcExpr* expr, int max_depth){
   if (expr->type == Node_Leaf){
     ppFloat(expr->value);
   } else {
-    VG_(printf)("(%s", opSym(expr->branch.op));
-    for(int i = 0 ; i < expr->branch.nargs; ++i){
+    VG_(printf)("(%s", opSym(concExprOp(expr)));
+    for(int i = 0 ; i < expr->nargs; ++i){
       VG_(printf)(" ");
       if (max_depth > 1){
-        ppConcExprBounded(expr, max_depth - 1);
+        ppConcExprBounded(concExprArg(expr, i), max_depth - 1);
       } else {
         VG_(printf)("_");
       }
@@ -903,11 +997,10 @@ void ppConcExpr(ConcExpr* expr){
   if (expr->type == Node_Leaf){
     ppFloat(expr->value);
   } else {
-    VG_(printf)("(%s", opSym(expr->branch.op));
-    for (int i = 0; i < expr->branch.nargs; ++i){
+    VG_(printf)("(%s", opSym(concExprOp(expr)));
+    for (int i = 0; i < expr->nargs; ++i){
       VG_(printf)(" ");
-      tl_assert(expr->branch.nargs > i);
-      ppConcExpr(expr->branch.args[i]);
+      ppConcExpr(concExprArg(expr, i));
     }
     VG_(printf)(")");
   }
@@ -48,22 +48,78 @@ typedef enum {
   Node_Leaf
 } NodeType;
 
+#define MAX_BRANCH_ARGS 4
+
+// Concrete expression nodes all live in one pool, made of large
+// contiguous chunks of CEXPR_CHUNK_SIZE nodes, and refer to their
+// children by 32-bit index into that pool instead of by
+// pointer. Index 0 is never handed out, so it can stand for "no
+// node". Nodes never move once they're allocated, so it's still fine
+// to hold on to pointers to them elsewhere.
+//
+// Nodes are kept to 40 bytes: the site that made a node is stored by
+// its id rather than by pointer, and the shadow value count shares a
+// word with the type and argument count.
+typedef UInt ConcExprIdx;
+#define CEXPR_CHUNK_BITS 14
+#define CEXPR_CHUNK_SIZE (1 << CEXPR_CHUNK_BITS)
+#define MAX_CEXPR_CHUNKS (1 << (32 - CEXPR_CHUNK_BITS))
+#define CEXPR_VALUE_REFS_BITS 27
+#define MAX_CEXPR_VALUE_REFS ((1 << CEXPR_VALUE_REFS_BITS) - 1)
+
 struct _ConcExpr {
-  struct _ConcExpr* next;
-  int ref_count;
-  NodeType type;
   double value;
   struct {
-    ShadowOpInfo* op;
-    int nargs;
-    ConcExpr** args;
+    // The id of the site that made this node. See concExprOp.
+    UInt op_id;
+    // While the node is free, args[0] links to the next free node.
+    ConcExprIdx args[MAX_BRANCH_ARGS];
   } branch;
+  // This node's own index in the pool.
+  ConcExprIdx idx;
+  // References from the windows of nodes above this one, and from
+  // shadow values. See exprs.c.
+  int ref_count;
+  UInt value_refs : CEXPR_VALUE_REFS_BITS;
+  UInt nargs : 4;
+  UInt type : 1;
 };
 
+extern ConcExpr* cexprChunks[MAX_CEXPR_CHUNKS];
+
+inline ConcExpr* concExprAt(ConcExprIdx idx);
+inline ConcExpr* concExprArg(ConcExpr* expr, int argIdx);
+inline ShadowOpInfo* concExprOp(ConcExpr* expr);
+
+__attribute__((always_inline))
+inline
+ConcExpr* concExprAt(ConcExprIdx idx){
+  return &(cexprChunks[idx >> CEXPR_CHUNK_BITS]
+           [idx & (CEXPR_CHUNK_SIZE - 1)]);
+}
+__attribute__((always_inline))
+inline
+ConcExpr* concExprArg(ConcExpr* expr, int argIdx){
+  return concExprAt(expr->branch.args[argIdx]);
+}
+__attribute__((always_inline))
+inline
+ShadowOpInfo* concExprOp(ConcExpr* expr){
+  return opInfosById[expr->branch.op_id];
+}
+
 List_H(NodePos, Group);
 Xarray_H(Group, GroupList);
 
-extern Stack* leafCExprs;
+// A flat view of the entries of a branch's range and example tables,
+// so that updating them on every problematic evaluation doesn't have
+// to go through the hash tables. It points into the table entries,
+// and gets rebuilt whenever entries are added or removed.
+typedef struct _RangeSlot {
+  NodePos position;
+  RangeRecord* range;
+  double* example;
+} RangeSlot;
 
 struct _SymbExpr {
   NodeType type;
@@ -76,6 +132,11 @@ struct _SymbExpr {
     GroupList groups;
     VgHashTable* varProblematicRanges;
     VgHashTable* exampleProblematicArgs;
+    RangeSlot* rangeSlots;
+    int numRangeSlots;
+    Bool rangeSlotsStale;
+    // Whether every example input has been filled in.
+    Bool exampleComplete;
   } branch;
 };
 
@@ -84,12 +145,10 @@ typedef struct _varMap {
   int nextVarIdx;
 } VarMap;
 
-void recursivelyOwnConcExpr(ConcExpr* expr, int depth);
-void recursivelyDisownConcExpr(ConcExpr* expr, int depth);
 void initExprAllocator(void);
 ConcExpr* mkLeafConcExpr(double value);
 ConcExpr* mkBranchConcExpr(double value, ShadowOpInfo* op, int nargs, ConcExpr** args);
-VG_REGPARM(1) void freeBranchConcExpr(ConcExpr* expr);
+void ownConcExpr(ConcExpr* expr);
 void disownConcExpr(ConcExpr* expr);
 SymbExpr* mkFreshSymbolicLeaf(Bool isConst, double constVal);
 SymbExpr* concreteToSymbolic(ConcExpr* cexpr);
@@ -104,6 +163,7 @@ void addExampleEntryCopy(VgHashTable* exampleTable,
                          NodePos position, double original);
 void addInitialExampleEntry(VgHashTable* exampleMap, NodePos position);
 void updateProblematicRanges(SymbExpr* symbExpr, ConcExpr* cexpr);
+void rebuildRangeSlots(SymbExpr* symbExpr);
 RangeRecord* lookupRangeRecord(VgHashTable* rangeMap, NodePos position);
 double lookupExampleInput(VgHashTable* exampleMap, NodePos position);
 void getRangesAndExample(RangeRecord** totalRangesOut,
@@ -144,5 +204,4 @@ void writeSymbExprToStringNoVars(int buflen, char* buf, SymbExpr* expr);
 
 
 int floatPrintLen(double f);
-#define MAX_BRANCH_ARGS 4
 #endif
@@ -31,90 +31,182 @@
 #include "pub_tool_mallocfree.h"
 #include "pub_tool_libcassert.h"
 #include "pub_tool_libcprint.h"
+#include "pub_tool_libcbase.h"
 
 #include "../../options.h"
 #include "../../helper/runtime-util.h"
 
-InfluenceList pool = NULL;
+// The smallest size class holds this many influences, and each one
+// after that holds four times as many as the last, up to
+// max_influences.
+#define MIN_INFLUENCE_CAPACITY 4
+#define MAX_INFLUENCE_SIZE_CLASSES 8
+// Sorts after every real site id.
+#define NO_INFLUENCE_ID 0xFFFFFFFF
 
-InfluenceList mkInfluenceList(void){
+static InfluenceList pools[MAX_INFLUENCE_SIZE_CLASSES] = {NULL};
+static VgHashTable* internedLists = NULL;
+// Where merges are built before we know whether they're new.
+static UInt* mergeScratch = NULL;
+
+static int sizeClassCapacity(int sizeClass){
+  int capacity = MIN_INFLUENCE_CAPACITY;
+  for(int i = 0; i < sizeClass && capacity < max_influences; ++i){
+    capacity *= 4;
+  }
+  return capacity < max_influences ? capacity : max_influences;
+}
+
+static InfluenceList allocInfluenceList(int capacity){
+  tl_assert(capacity <= max_influences);
+  int sizeClass = 0;
+  while(sizeClassCapacity(sizeClass) < capacity){
+    sizeClass++;
+  }
+  tl_assert(sizeClass < MAX_INFLUENCE_SIZE_CLASSES);
   InfluenceList result;
-  if (pool == NULL){
+  if (pools[sizeClass] == NULL){
+    // The ids live right after the list header, so each list is one
+    // allocation.
     result =
-      VG_(malloc)("influence list", sizeof(struct _influenceList));
-    result->data =
-      VG_(malloc)("influence list data", sizeof(ShadowOpInfo*) * max_influences);
+      VG_(malloc)("influence list",
+                  sizeof(struct _influenceList) +
+                  sizeof(UInt) * sizeClassCapacity(sizeClass));
+    result->ids = (UInt*)(result + 1);
+    result->sizeClass = sizeClass;
   } else {
-    result = pool;
-    pool = pool->next;
+    result = pools[sizeClass];
+    pools[sizeClass] = result->next;
   }
   result->next = NULL;
   result->length = 0;
   return result;
 }
 
+static UWord hashIds(const UInt* ids, int length){
+  UWord hash = length;
+  for(int i = 0; i < length; ++i){
+    hash = hash * 31 + ids[i];
+  }
+  return hash;
+}
+
+static Bool hasIds(InfluenceList il, const UInt* ids, int length){
+  return il != NULL && il->length == length &&
+    VG_(memcmp)(il->ids, ids, sizeof(UInt) * length) == 0;
+}
+
+static Word cmpInfluenceList(const void* node1, const void* node2){
+  const struct _influenceList* il1 = node1;
+  const struct _influenceList* il2 = node2;
+  if (il1->length == il2->length &&
+      VG_(memcmp)(il1->ids, il2->ids, sizeof(UInt) * il1->length) == 0){
+    return 0;
+  } else {
+    return 1;
+  }
+}
+
+InfluenceList mkInfluenceList(const UInt* ids, int length){
+  if (internedLists == NULL){
+    internedLists = VG_(HT_construct)("interned influence lists");
+  }
+  struct _influenceList key;
+  key.hash = hashIds(ids, length);
+  key.length = length;
+  key.ids = (UInt*)ids;
+  InfluenceList existing =
+    VG_(HT_gen_lookup)(internedLists, &key, cmpInfluenceList);
+  if (existing != NULL){
+    return shareInfluences(existing);
+  }
+  InfluenceList result = allocInfluenceList(length);
+  VG_(memcpy)(result->ids, ids, sizeof(UInt) * length);
+  result->length = length;
+  result->hash = key.hash;
+  result->ref_count = 1;
+  VG_(HT_add_node)(internedLists, result);
+  return result;
+}
+
 void freeInfluenceList(InfluenceList il){
-  il->next = pool;
-  pool = il;
+  tl_assert(il->ref_count > 0);
+  il->ref_count--;
+  if (il->ref_count > 0){
+    return;
+  }
+  InfluenceList removed =
+    VG_(HT_gen_remove)(internedLists, il, cmpInfluenceList);
+  tl_assert(removed == il);
+  il->next = pools[il->sizeClass];
+  pools[il->sizeClass] = il;
 }
 
-inline int score(ShadowOpInfo* info);
-inline int score(ShadowOpInfo* info){
-  return info->agg.local_error.max_error;
+InfluenceList shareInfluences(InfluenceList il){
+  if (il != NULL){
+    il->ref_count++;
+  }
+  return il;
+}
+
+ShadowOpInfo* influenceAt(InfluenceList il, int idx){
+  return getOpInfoById(il->ids[idx]);
 }
 
 InfluenceList mergeInfluences(InfluenceList il1, InfluenceList il2,
                               ShadowOpInfo* extra){
   if (il1 == NULL && il2 == NULL && extra == NULL) return NULL;
-  InfluenceList result = mkInfluenceList();
+  // Most ops don't flag anything, and often only have one argument
+  // with influences, so their result is just that argument's list.
+  if (extra == NULL){
+    if (il2 == NULL || il2 == il1){
+      return shareInfluences(il1);
+    } else if (il1 == NULL){
+      return shareInfluences(il2);
+    }
+  }
+  if (mergeScratch == NULL){
+    mergeScratch = VG_(malloc)("influence merge scratch",
+                               sizeof(UInt) * max_influences);
+  }
+  int len1 = il1 == NULL ? 0 : il1->length;
+  int len2 = il2 == NULL ? 0 : il2->length;
+  UInt extraId = extra == NULL ? NO_INFLUENCE_ID : extra->id;
   int i = 0;
   int j = 0;
-  while(((il1 != NULL && i < il1->length) ||
-         (il2 != NULL && j < il2->length) ||
-         extra != NULL) &&
-        result->length < max_influences){
-    if (il1 != NULL && i < il1->length &&
-        (il2 == NULL || j >= il2->length || cmpInfo(il1->data[i], il2->data[j]) >= 0) &&
-        (extra == NULL || cmpInfo(il1->data[i], extra) >= 0)){
-      if (result->length == 0 || result->data[result->length-1] != il1->data[i]){
-        result->data[result->length++] = il1->data[i];
-      }
+  int length = 0;
+  // When there are more than max_influences, we keep the ones with
+  // the lowest ids.
+  while(length < max_influences){
+    UInt next = extraId;
+    if (i < len1 && il1->ids[i] < next){
+      next = il1->ids[i];
+    }
+    if (j < len2 && il2->ids[j] < next){
+      next = il2->ids[j];
+    }
+    if (next == NO_INFLUENCE_ID){
+      break;
+    }
+    if (i < len1 && il1->ids[i] == next){
       i++;
-    } else if (il2 != NULL && j < il2->length &&
-               (il1 == NULL || i >= il1->length ||
-                cmpInfo(il2->data[j], il1->data[i]) >= 0) &&
-               (extra == NULL || cmpInfo(il2->data[j], extra) >= 0)){
-      if (result->length == 0 || result->data[result->length-1] != il2->data[j]){
-        result->data[result->length++] = il2->data[j];
-      }
+    }
+    if (j < len2 && il2->ids[j] == next){
       j++;
-    } else if (extra != NULL &&
-               (il1 == NULL || i >= il1->length || cmpInfo(extra, il1->data[i]) >= 0) &&
-               (il2 == NULL || j >= il2->length || cmpInfo(extra, il2->data[j]) >= 0)){
-      if (result->length == 0 || result->data[result->length-1] != extra){
-        result->data[result->length++] = extra;
-      }
-      extra = NULL;
-    } else {
-      VG_(printf)("cmpInfo(il2->data[j], il1->data[i]) : %d\n",
-                  cmpInfo(il2->data[j], il1->data[i]));
-      VG_(printf)("il2->data[j]: %p\nil1->data[i]: %p\n",
-                  il2->data[j], il1->data[i]);
-      VG_(printf)("extra: %p\n", extra);
-      VG_(printf)("i: %d, il1: %p", i, il1);
-      if (il1 != NULL){
-        VG_(printf)(" il1->length : %d", il1->length);
-      }
-      VG_(printf)("\n");
-      VG_(printf)("j: %d, il2: %p", j, il2);
-      if (il2 != NULL){
-        VG_(printf)(" il2->length : %d", il2->length);
-      }
-      VG_(printf)("\n");
-      tl_assert(0);
     }
+    if (extraId == next){
+      extraId = NO_INFLUENCE_ID;
+    }
+    mergeScratch[length++] = next;
   }
-  return result;
+  // When one side already had everything, it's the interned copy of
+  // the result, so we don't need to look it up.
+  if (hasIds(il1, mergeScratch, length)){
+    return shareInfluences(il1);
+  } else if (hasIds(il2, mergeScratch, length)){
+    return shareInfluences(il2);
+  }
+  return mkInfluenceList(mergeScratch, length);
 }
 
 void ppInfluences(InfluenceList influences){
@@ -123,25 +215,24 @@ void ppInfluences(InfluenceList influences){
   }
   for(int i = 0; i < influences->length; ++i){
     VG_(printf)("* ");
-    printOpInfo(influences->data[i]);
+    printOpInfo(influenceAt(influences, i));
     VG_(printf)("\n");
   }
 }
 
 void assertNoDups(InfluenceList influences){
-  for(int i = 0; i < influences->length; ++i){
-    for(int j = i+1; j < influences->length; ++j){
-      if (influences->data[i] == influences->data[j]){
-        VG_(printf)("Influence #%d (", i);
-        printOpInfo(influences->data[i]);
-        VG_(printf)(") and influence #%d (", j);
-        printOpInfo(influences->data[j]);
-        VG_(printf)(" are the same!\n");
-        VG_(printf)("In list:\n");
-        ppInfluences(influences);
-      }
-      tl_assert(influences->data[i] != influences->data[j]);
+  // Sorted and without duplicates means strictly increasing.
+  for(int i = 1; i < influences->length; ++i){
+    if (influences->ids[i - 1] >= influences->ids[i]){
+      VG_(printf)("Influence #%d (", i - 1);
+      printOpInfo(influenceAt(influences, i - 1));
+      VG_(printf)(") and influence #%d (", i);
+      printOpInfo(influenceAt(influences, i));
+      VG_(printf)(" are out of order!\n");
+      VG_(printf)("In list:\n");
+      ppInfluences(influences);
     }
+    tl_assert(influences->ids[i - 1] < influences->ids[i]);
   }
 }
 
@@ -151,7 +242,7 @@ void assertNoDropInfluences(InfluenceList influences1,
   if (influences1 != NULL){
     for(int i = 0; i < influences1->length; ++i){
       Bool mergedHasAllFromFirstArg =
-        hasInfluence(merged, influences1->data[i]);
+        hasInfluence(merged, influenceAt(influences1, i));
       if (!mergedHasAllFromFirstArg){
         VG_(printf)("Tried to merge:\n");
         ppInfluences(influences1);
@@ -166,7 +257,7 @@ void assertNoDropInfluences(InfluenceList influences1,
   if (influences2 != NULL){
     for(int i = 0; i < influences2->length; ++i){
       Bool mergedHasAllFromSecondArg =
-        hasInfluence(merged, influences2->data[i]);
+        hasInfluence(merged, influenceAt(influences2, i));
       if (!mergedHasAllFromSecondArg){
         VG_(printf)("Tried to merge:\n");
         ppInfluences(influences1);
@@ -181,9 +272,16 @@ void assertNoDropInfluences(InfluenceList influences1,
 }
 
 Bool hasInfluence(InfluenceList list, ShadowOpInfo* influence){
-  for(int i = 0; i < list->length; ++i){
-    if (list->data[i] == influence){
+  int lo = 0;
+  int hi = list->length;
+  while(lo < hi){
+    int mid = lo + (hi - lo) / 2;
+    if (list->ids[mid] == influence->id){
       return True;
+    } else if (list->ids[mid] < influence->id){
+      lo = mid + 1;
+    } else {
+      hi = mid;
     }
   }
   return False;
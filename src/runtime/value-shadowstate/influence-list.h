@@ -32,16 +32,34 @@
 
 #include "../op-shadowstate/shadowop-info.h"
 
+// An influence list is the set of sites influencing a value, kept as
+// a sorted array of site ids, so that merging two of them is one
+// linear pass over small integers. The arrays come in a few size
+// classes, so values with only a couple of influences don't each
+// carry room for max_influences of them.
+//
+// Lists are immutable and interned, so there's only ever one copy of
+// each set, shared by every value it influences, and counted by
+// ref_count. The first two fields are for the intern table.
 typedef struct _influenceList{
   struct _influenceList* next;
+  UWord hash;
+  int ref_count;
   int length;
-  ShadowOpInfo** data;
+  int sizeClass;
+  UInt* ids;
 } *InfluenceList;
 
-InfluenceList mkInfluenceList(void);
+// Get the interned list of the given ids, which have to be sorted
+// and without duplicates. The caller owns a reference to the result.
+InfluenceList mkInfluenceList(const UInt* ids, int length);
+// Give up a reference to a list.
 void freeInfluenceList(InfluenceList il);
+// Get another reference to a list.
+InfluenceList shareInfluences(InfluenceList il);
 InfluenceList mergeInfluences(InfluenceList il1, InfluenceList il2,
                               ShadowOpInfo* extra);
+ShadowOpInfo* influenceAt(InfluenceList il, int idx);
 void ppInfluences(InfluenceList influences);
 void assertNoDropInfluences(InfluenceList influences1,
                             InfluenceList influences2,
@@ -31,35 +31,42 @@
 
 #include "pub_tool_libcbase.h"
 #include "pub_tool_libcprint.h"
+#include "pub_tool_libcassert.h"
+#include "pub_tool_mallocfree.h"
 
-Xarray_Impl(NodePos, PosList);
+#include "../../options.h"
 
 NodePos null_pos;
 
+static NodePos mkPosNode(NodePos parent, int len){
+  NodePos node =
+    VG_(perm_malloc)(sizeof(struct _posTreeNode) +
+                     sizeof(unsigned char) * len,
+                     vg_alignof(struct _posTreeNode));
+  node->parent = parent;
+  for(int i = 0; i < MAX_POS_CHILDREN; ++i){
+    node->children[i] = NULL;
+  }
+  node->len = len;
+  return node;
+}
+
 void initializePositionTree(void){
-  null_pos = VG_(perm_malloc)(sizeof(struct _posTreeNode),
-                              vg_alignof(struct _posTreeNode));
-  null_pos->children = mkXA(PosList)();
-  null_pos->data= NULL;
-  null_pos->len = 0;
+  null_pos = mkPosNode(NULL, 0);
 }
 
 NodePos rconsPos(NodePos parent, unsigned char childIndex){
-  while (parent->children->size <= childIndex){
-    NodePos newNode =
-      VG_(perm_malloc)(sizeof(struct _posTreeNode),
-                       vg_alignof(struct _posTreeNode));
-    newNode->children = mkXA(PosList)();
-    newNode->data =
-      VG_(perm_malloc)(sizeof(unsigned char) * (parent->len + 1),
-                       vg_alignof(NodePos));
-    newNode->len = parent->len + 1;
-    VG_(memcpy)(newNode->data, parent->data, parent->len);
-    newNode->data[parent->len] = parent->children->size;
-    newNode->parent = parent;
-    XApush(PosList)(parent->children, newNode);
+  tl_assert(childIndex < MAX_POS_CHILDREN);
+  NodePos result = parent->children[childIndex];
+  if (result == NULL){
+    tl_assert2(parent->len < max_expr_block_depth * 2,
+               "Position is longer than any expression we look at "
+               "(%d steps)", parent->len + 1);
+    result = mkPosNode(parent, parent->len + 1);
+    VG_(memcpy)(result->data, parent->data, parent->len);
+    result->data[parent->len] = childIndex;
+    parent->children[childIndex] = result;
   }
-  NodePos result = parent->children->data[childIndex];
   return result;
 }
 NodePos rtail(NodePos child){
@@ -76,6 +83,16 @@ NodePos appendPos(NodePos prefix, NodePos suffix){
   return curPos;
 }
 
+Bool posIsUnder(NodePos pos, NodePos prefix){
+  if (pos->len <= prefix->len){
+    return False;
+  }
+  while(pos->len > prefix->len){
+    pos = pos->parent;
+  }
+  return pos == prefix;
+}
+
 void ppNodePos(NodePos pos){
   VG_(printf)("[");
   for(int i = 0; i < pos->len; ++i){
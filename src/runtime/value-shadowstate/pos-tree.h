@@ -30,16 +30,26 @@
 #ifndef _POS_TREE_H
 #define _POS_TREE_H
 
-#include "../../helper/xarray.h"
-
+#include "pub_tool_basics.h"
+
+// Positions are interned: there is exactly one node for each path,
+// so they can be compared and hashed by pointer. Each node carries
+// its path inline.
+//
+// Nothing looks further into an expression than twice
+// --max-expr-block-depth, so no position is longer than that, and
+// rconsPos won't make one that is. That keeps the tree from growing
+// any deeper than the expressions it indexes.
 typedef struct _posTreeNode* NodePos;
 
-Xarray_H(NodePos, PosList);
+// This has to be at least MAX_BRANCH_ARGS.
+#define MAX_POS_CHILDREN 4
+
 struct _posTreeNode {
   NodePos parent;
-  PosList children;
-  unsigned char* data;
+  NodePos children[MAX_POS_CHILDREN];
   int len;
+  unsigned char data[];
 };
 
 extern NodePos null_pos;
@@ -50,6 +60,8 @@ NodePos rconsPos(NodePos parent, unsigned char childIndex);
 NodePos rtail(NodePos parent);
 unsigned char rhead(NodePos parent);
 NodePos appendPos(NodePos prefix, NodePos suffix);
+// Whether prefix is a proper prefix of pos.
+Bool posIsUnder(NodePos pos, NodePos prefix);
 
 UWord hashPosition(NodePos node);
 
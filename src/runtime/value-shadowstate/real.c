@@ -33,10 +33,67 @@
 #include "pub_tool_libcprint.h"
 #include "pub_tool_libcassert.h"
 
+#include <math.h>
+
+#ifdef USE_MPFR
+// With --double-double, most reals never leave double-double land,
+// so they don't get limbs until something needs their mpfr value.
+static void initRealMPFR(Real real){
+  if (!real->mpfr_inited){
+    mpfr_init2(real->mpfr_val, precision);
+    real->mpfr_inited = True;
+  }
+}
+#endif
+
 Real mkReal(void){
   Real result = VG_(malloc)("real", sizeof(struct _RealStruct));
+  result->pending = NULL;
+  #ifdef USE_MPFR
+  result->dd.hi = 0.0;
+  result->dd.lo = 0.0;
+  result->dd.bits = DD_EXACT_BITS;
+  result->escalated = !use_double_double;
+  result->mpfr_inited = False;
+  if (!use_double_double){
+    initRealMPFR(result);
+  }
+  #else
+  mpf_init2(result->mpf_val, precision);
+  #endif
+  return result;
+}
+SizeT realInlineSize(void){
+  #ifdef USE_MPFR
+  if (use_double_double){
+    return sizeof(struct _RealStruct);
+  }
+  return sizeof(struct _RealStruct) + mpfr_custom_get_size(precision);
+  #else
+  return sizeof(struct _RealStruct);
+  #endif
+}
+Real mkRealAt(void* mem){
+  Real result = mem;
+  result->pending = NULL;
   #ifdef USE_MPFR
-  mpfr_init2(result->mpfr_val, precision);
+  result->dd.hi = 0.0;
+  result->dd.lo = 0.0;
+  result->dd.bits = DD_EXACT_BITS;
+  result->escalated = !use_double_double;
+  if (use_double_double){
+    // These get their limbs from initRealMPFR, if ever.
+    result->mpfr_inited = False;
+    return result;
+  }
+  // The limbs go right after the struct. mpfr never reallocates
+  // values made through the custom interface, which is fine, since
+  // we only ever change their precision with mpfr_set_prec_raw.
+  void* limbs = (char*)mem + sizeof(struct _RealStruct);
+  mpfr_custom_init(limbs, precision);
+  mpfr_custom_init_set(result->mpfr_val, MPFR_ZERO_KIND, 0,
+                       precision, limbs);
+  result->mpfr_inited = True;
   #else
   mpf_init2(result->mpf_val, precision);
   #endif
@@ -44,6 +101,17 @@ Real mkReal(void){
 }
 void setReal(Real r, double bytes){
   #ifdef USE_MPFR
+  if (use_double_double){
+    r->dd.hi = bytes;
+    r->dd.lo = 0.0;
+    r->dd.bits = DD_EXACT_BITS;
+    r->escalated = False;
+    return;
+  }
+  r->escalated = True;
+  if (adaptive_precision){
+    mpfr_set_prec_raw(r->mpfr_val, precision);
+  }
   mpfr_set_d(r->mpfr_val, bytes, MPFR_RNDN);
   #else
   mpf_set_d(r->mpf_val, bytes);
@@ -51,7 +119,9 @@ void setReal(Real r, double bytes){
 }
 void freeReal(Real real){
   #ifdef USE_MPFR
-  mpfr_clear(real->mpfr_val);
+  if (real->mpfr_inited){
+    mpfr_clear(real->mpfr_val);
+  }
   #else
   mpf_clear(real->mpf_val);
   #endif
@@ -60,7 +130,13 @@ void freeReal(Real real){
 
 double getDouble(Real real){
   if (no_reals) return 0.0;
+  forceReal(real);
   #ifdef USE_MPFR
+  if (!real->escalated){
+    // The high part of a normalized double-double is always its
+    // value rounded to the nearest double.
+    return real->dd.hi;
+  }
   return mpfr_get_d(real->mpfr_val, MPFR_RNDN);
   #else
   return mpf_get_d(real->mpf_val);
@@ -69,37 +145,323 @@ double getDouble(Real real){
 
 int isNaN(Real real){
   if (no_reals) return 0;
+  forceReal(real);
   #ifdef USE_MPFR
+  if (!real->escalated){
+    return real->dd.hi != real->dd.hi;
+  }
   return mpfr_nan_p(real->mpfr_val);
   #else
   return mpf_nan_p(real->mpf_val);
   #endif
 }
 int realCompare(Real real1, Real real2){
+  forceReal(real1);
+  forceReal(real2);
   #ifdef USE_MPFR
-  return mpfr_cmp(real1->mpfr_val, real2->mpfr_val);
+  if (!real1->escalated && !real2->escalated){
+    return ddCompare(&(real1->dd), &(real2->dd));
+  }
+  return mpfr_cmp(realMPFR(real1), realMPFR(real2));
   #else
   return mpf_cmp(real1->mpf_val, real2->mpf_val);
   #endif
 }
 
 void copyReal(Real src, Real dest){
+  forceReal(src);
   #ifdef USE_MPFR
-  mpfr_set(dest->mpfr_val, src->mpfr_val, MPFR_RNDN);
+  dest->dd = src->dd;
+  dest->escalated = src->escalated;
+  if (src->escalated){
+    initRealMPFR(dest);
+    mpfr_set_prec_raw(dest->mpfr_val, mpfr_get_prec(src->mpfr_val));
+    mpfr_set(dest->mpfr_val, src->mpfr_val, MPFR_RNDN);
+  }
   #else
   mpf_set(dest->mpf_val, src->mpf_val);
   #endif
 }
 
 void printReal(Real real){
+  forceReal(real);
   #ifdef USE_MPFR
   char* shadowValStr;
   mpfr_exp_t shadowValExpt;
 
-  shadowValStr = mpfr_get_str(NULL, &shadowValExpt, 10, longprint_len, real->mpfr_val, MPFR_RNDN);
+  shadowValStr = mpfr_get_str(NULL, &shadowValExpt, 10, longprint_len,
+                              realMPFR(real), MPFR_RNDN);
   VG_(printf)("%c.%se%ld", shadowValStr[0], shadowValStr+1, shadowValExpt-1);
   mpfr_free_str(shadowValStr);
   #else
   tl_assert2(0, "Can't print GMP vals!\n");
   #endif
 }
+
+void setRealPrecision(Real real, int bits){
+  #ifdef USE_MPFR
+  if (!real->mpfr_inited){
+    return;
+  }
+  mpfr_set_prec_raw(real->mpfr_val, bits);
+  #else
+  mpf_set_prec_raw(real->mpf_val, bits);
+  #endif
+}
+
+#ifdef USE_MPFR
+mpfr_ptr realMPFR(Real real){
+  forceReal(real);
+  initRealMPFR(real);
+  if (!real->escalated){
+    // The two halves don't overlap, so this is exact, as long as
+    // we're at full precision.
+    mpfr_set_prec_raw(real->mpfr_val, precision);
+    mpfr_set_d(real->mpfr_val, real->dd.hi, MPFR_RNDN);
+    mpfr_add_d(real->mpfr_val, real->mpfr_val, real->dd.lo, MPFR_RNDN);
+  }
+  return real->mpfr_val;
+}
+mpfr_ptr realMPFRResult(Real real){
+  initRealMPFR(real);
+  real->escalated = True;
+  return real->mpfr_val;
+}
+void demoteReal(Real real, int bits){
+  tl_assert(real->escalated);
+  real->dd.hi = mpfr_get_d(real->mpfr_val, MPFR_RNDN);
+  mpfr_sub_d(real->mpfr_val, real->mpfr_val, real->dd.hi, MPFR_RNDN);
+  real->dd.lo = mpfr_get_d(real->mpfr_val, MPFR_RNDN);
+  real->dd.bits = bits;
+  real->escalated = False;
+}
+void demoteRealIfExact(Real real){
+  if (!use_double_double || !real->escalated ||
+      !mpfr_regular_p(real->mpfr_val)){
+    return;
+  }
+  // Anything with at most DD_EXACT_BITS of mantissa is the sum of its
+  // nearest double and what's left over, as long as neither end is
+  // anywhere near the edges of the range.
+  if (mpfr_min_prec(real->mpfr_val) > DD_EXACT_BITS){
+    return;
+  }
+  DoubleDouble rounded = {mpfr_get_d(real->mpfr_val, MPFR_RNDN), 0.0, 0};
+  if (!ddInSafeRange(&rounded)){
+    return;
+  }
+  // mpfr computed it correctly rounded, not exactly, so this isn't
+  // DD_EXACT_BITS.
+  demoteReal(real, DD_PRECISION_BITS);
+}
+
+// The error-free transformations that double-double arithmetic is
+// built out of. See Shewchuk, "Adaptive Precision Floating-Point
+// Arithmetic and Fast Robust Geometric Predicates", and the QD
+// library by Hida, Li, and Bailey, which the operations below
+// follow.
+static inline double quickTwoSum(double a, double b, double* err){
+  double s = a + b;
+  *err = b - (s - a);
+  return s;
+}
+static inline double twoSum(double a, double b, double* err){
+  double s = a + b;
+  double bb = s - a;
+  *err = (a - (s - bb)) + (b - bb);
+  return s;
+}
+// 2^27 + 1
+#define DD_SPLITTER 134217729.0
+static inline void split(double a, double* hi, double* lo){
+  double temp = DD_SPLITTER * a;
+  *hi = temp - (temp - a);
+  *lo = a - *hi;
+}
+static inline double twoProd(double a, double b, double* err){
+  double p = a * b;
+  double a_hi, a_lo, b_hi, b_lo;
+  split(a, &a_hi, &a_lo);
+  split(b, &b_hi, &b_lo);
+  *err = ((a_hi * b_hi - p) + a_hi * b_lo + a_lo * b_hi) + a_lo * b_lo;
+  return p;
+}
+
+static inline void rawAdd(DoubleDouble* res,
+                          double a_hi, double a_lo,
+                          double b_hi, double b_lo){
+  double s2, t2;
+  double s1 = twoSum(a_hi, b_hi, &s2);
+  double t1 = twoSum(a_lo, b_lo, &t2);
+  s2 += t1;
+  s1 = quickTwoSum(s1, s2, &s2);
+  s2 += t2;
+  res->hi = quickTwoSum(s1, s2, &(res->lo));
+}
+static inline void rawMulDouble(DoubleDouble* res,
+                                double a_hi, double a_lo, double b){
+  double p2;
+  double p1 = twoProd(a_hi, b, &p2);
+  p2 += a_lo * b;
+  res->hi = quickTwoSum(p1, p2, &(res->lo));
+}
+
+static inline int ddExponent(double x){
+  union { double d; ULong u; } conv;
+  conv.d = x;
+  return (int)((conv.u >> 52) & 0x7ff) - 1023;
+}
+static inline int minBits(int a, int b){
+  return a < b ? a : b;
+}
+static inline int clampBits(int bits){
+  if (bits < 0) return 0;
+  if (bits > DD_PRECISION_BITS) return DD_PRECISION_BITS;
+  return bits;
+}
+// How many bits of the result of an addition an argument can vouch
+// for. Absolute error in the argument carries straight through to
+// the result, so when the result is smaller than the argument
+// (cancellation), the correct bits shrink by the difference in
+// exponents. Exact arguments don't have any error to carry, so they
+// can cancel as much as they like.
+static inline int addArgBits(const DoubleDouble* arg, double resultHi){
+  if (arg->bits == DD_EXACT_BITS){
+    return DD_PRECISION_BITS;
+  }
+  if (arg->hi == 0.0){
+    return 0;
+  }
+  return arg->bits - (ddExponent(arg->hi) - ddExponent(resultHi));
+}
+// Multiplying by zero is exact, as long as the zero is, otherwise we
+// have no idea how big the result really is.
+static inline Bool hasZeroArg(const DoubleDouble* a, const DoubleDouble* b,
+                              int* bits){
+  if (a->hi == 0.0 || b->hi == 0.0){
+    const DoubleDouble* zero = a->hi == 0.0 ? a : b;
+    *bits = zero->bits == DD_EXACT_BITS ? DD_EXACT_BITS : 0;
+    return True;
+  }
+  return False;
+}
+
+void ddAdd(DoubleDouble* res, const DoubleDouble* a, const DoubleDouble* b){
+  DoubleDouble sum;
+  rawAdd(&sum, a->hi, a->lo, b->hi, b->lo);
+  if (a->bits == DD_EXACT_BITS && b->bits == DD_EXACT_BITS &&
+      a->lo == 0.0 && b->lo == 0.0){
+    // TwoSum of two doubles is exact, cancellation or not.
+    sum.bits = DD_EXACT_BITS;
+  } else if (sum.hi == 0.0){
+    // Exact arguments only cancel to zero if their sum really is
+    // zero.
+    sum.bits =
+      a->bits == DD_EXACT_BITS && b->bits == DD_EXACT_BITS ?
+      DD_EXACT_BITS : 0;
+  } else {
+    sum.bits = clampBits(minBits(addArgBits(a, sum.hi),
+                                 addArgBits(b, sum.hi)));
+  }
+  *res = sum;
+}
+void ddSub(DoubleDouble* res, const DoubleDouble* a, const DoubleDouble* b){
+  DoubleDouble negB = {-(b->hi), -(b->lo), b->bits};
+  ddAdd(res, a, &negB);
+}
+void ddMul(DoubleDouble* res, const DoubleDouble* a, const DoubleDouble* b){
+  DoubleDouble prod;
+  int zeroBits;
+  if (hasZeroArg(a, b, &zeroBits)){
+    prod.hi = a->hi * b->hi;
+    prod.lo = 0.0;
+    prod.bits = zeroBits;
+    *res = prod;
+    return;
+  }
+  double p2;
+  double p1 = twoProd(a->hi, b->hi, &p2);
+  p2 += a->hi * b->lo + a->lo * b->hi;
+  prod.hi = quickTwoSum(p1, p2, &(prod.lo));
+  prod.bits = clampBits(minBits(a->bits, b->bits) - 1);
+  *res = prod;
+}
+void ddDiv(DoubleDouble* res, const DoubleDouble* a, const DoubleDouble* b){
+  DoubleDouble quot, rem, qb;
+  if (a->hi == 0.0){
+    quot.hi = a->hi / b->hi;
+    quot.lo = 0.0;
+    quot.bits = a->bits == DD_EXACT_BITS ? DD_EXACT_BITS : 0;
+    *res = quot;
+    return;
+  }
+  // Long division, one double's worth of quotient at a time.
+  double q1 = a->hi / b->hi;
+  rawMulDouble(&qb, b->hi, b->lo, q1);
+  rawAdd(&rem, a->hi, a->lo, -qb.hi, -qb.lo);
+  double q2 = rem.hi / b->hi;
+  rawMulDouble(&qb, b->hi, b->lo, q2);
+  rawAdd(&rem, rem.hi, rem.lo, -qb.hi, -qb.lo);
+  double q3 = rem.hi / b->hi;
+  q1 = quickTwoSum(q1, q2, &q2);
+  rawAdd(&quot, q1, q2, q3, 0.0);
+  quot.bits = clampBits(minBits(a->bits, b->bits) - 1);
+  *res = quot;
+}
+void ddSqrt(DoubleDouble* res, const DoubleDouble* a){
+  if (a->hi == 0.0){
+    *res = *a;
+    return;
+  }
+  // Karp's trick: one Newton step from the double square root.
+  DoubleDouble sq, diff, root;
+  double x = 1.0 / sqrt(a->hi);
+  double ax = a->hi * x;
+  sq.hi = twoProd(ax, ax, &(sq.lo));
+  rawAdd(&diff, a->hi, a->lo, -sq.hi, -sq.lo);
+  rawAdd(&root, ax, 0.0, diff.hi * (x * 0.5), 0.0);
+  // Square roots halve relative error, so they never lose bits.
+  root.bits = clampBits(a->bits);
+  *res = root;
+}
+// Whether a double-double is far enough from overflow and underflow
+// that the error-free transformations stay error free.
+Bool ddInSafeRange(const DoubleDouble* a){
+  double mag = a->hi < 0 ? -(a->hi) : a->hi;
+  if (mag == 0.0){
+    return True;
+  }
+  return mag > 1e-250 && mag < 1e290;
+}
+int ddCompare(const DoubleDouble* a, const DoubleDouble* b){
+  if (a->hi != b->hi){
+    return a->hi < b->hi ? -1 : 1;
+  }
+  if (a->lo != b->lo){
+    return a->lo < b->lo ? -1 : 1;
+  }
+  return 0;
+}
+int realPrecision(Real real){
+  forceReal(real);
+  if (!real->escalated){
+    return real->dd.bits;
+  }
+  return mpfr_get_prec(real->mpfr_val);
+}
+Bool realExponent(Real real, long* exponent){
+  forceReal(real);
+  if (!real->escalated){
+    if (!ddInSafeRange(&(real->dd)) || real->dd.hi == 0.0){
+      return False;
+    }
+    *exponent = ddExponent(real->dd.hi) + 1;
+    return True;
+  }
+  if (!mpfr_regular_p(real->mpfr_val)){
+    return False;
+  }
+  *exponent = mpfr_get_exp(real->mpfr_val);
+  return True;
+}
+#endif
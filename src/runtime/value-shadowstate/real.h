@@ -40,8 +40,43 @@
 
 #include "pub_tool_basics.h"
 
+#ifdef USE_MPFR
+// With --double-double, reals start out as an unevaluated sum of two
+// doubles, hi + lo, which gets us about 106 bits for a fraction of
+// the cost of mpfr. Along with that we keep a conservative count of
+// how many leading bits of the value are still correct. When that
+// drops below DD_MIN_BITS, which means cancellation has eaten too
+// much of the value for us to trust it, the result is recomputed in
+// mpfr, and that real is "escalated": it lives in mpfr_val, and so
+// does everything computed from it, until a result fits in a
+// double-double again. Reals don't get an mpfr_val at all until they
+// first need one.
+#define DD_EXACT_BITS 106
+#define DD_PRECISION_BITS 104
+#define DD_MIN_BITS 64
+
+typedef struct {
+  double hi;
+  double lo;
+  int bits;
+} DoubleDouble;
+#endif
+
+// With --lazy-reals, a real can be "pending": instead of a value, it
+// holds the operation that would compute it, which only gets run the
+// first time something reads the real. Pending reals are forced by
+// all of the accessors below, so only code that pokes at the fields
+// directly needs to worry about them.
+struct _PendingRealOp;
+
 typedef struct _RealStruct{
+  struct _PendingRealOp* pending;
   #ifdef USE_MPFR
+  DoubleDouble dd;
+  Bool escalated;
+  // Whether mpfr_val has been initialized. Always true without
+  // --double-double.
+  Bool mpfr_inited;
   mpfr_t mpfr_val;
   #else
   mpf_t mpf_val;
@@ -49,6 +84,12 @@ typedef struct _RealStruct{
 } *Real;
 
 Real mkReal(void);
+// For putting a real in memory the caller manages, along with (for
+// mpfr) the limbs of its value, so that the whole thing is one
+// contiguous block. Reals made this way must never be passed to
+// freeReal.
+SizeT realInlineSize(void);
+Real mkRealAt(void* mem);
 void setReal(Real r, double bytes);
 
 double getDouble(Real real);
@@ -58,14 +99,72 @@ int realCompare(Real real1, Real real2);
 void freeReal(Real real);
 void copyReal(Real src, Real dest);
 void printReal(Real real);
+// Set the precision the next result written into real will be
+// computed at. This has to be no more than --precision, since that's
+// what the real was allocated with. With --double-double, a real
+// that doesn't have an mpfr_val yet gets one at --precision when it
+// needs it, whatever this was set to.
+void setRealPrecision(Real real, int bits);
+// Compute the value of a pending real. Defined with the real
+// operations, in realop.c.
+void materializeReal(Real real);
 
+#ifdef USE_MPFR
+// Get the mpfr version of a real to read from. For reals that
+// haven't been escalated, this converts the double-double into
+// mpfr_val first, which is exact.
+mpfr_ptr realMPFR(Real real);
+// Get the mpfr version of a real to write a result to. This marks
+// the real as escalated.
+mpfr_ptr realMPFRResult(Real real);
+// Take an escalated real back down to a double-double, with the
+// given number of correct bits.
+void demoteReal(Real real, int bits);
+// Demote an escalated real if its value fits in a double-double
+// exactly, since then nothing is lost by it.
+void demoteRealIfExact(Real real);
+// How many bits the real carries, and its binary exponent. The
+// exponent is only meaningful for finite, nonzero reals, so
+// realExponent returns False for anything else.
+int realPrecision(Real real);
+Bool realExponent(Real real, long* exponent);
+
+void ddAdd(DoubleDouble* res, const DoubleDouble* a, const DoubleDouble* b);
+void ddSub(DoubleDouble* res, const DoubleDouble* a, const DoubleDouble* b);
+void ddMul(DoubleDouble* res, const DoubleDouble* a, const DoubleDouble* b);
+void ddDiv(DoubleDouble* res, const DoubleDouble* a, const DoubleDouble* b);
+void ddSqrt(DoubleDouble* res, const DoubleDouble* a);
+Bool ddInSafeRange(const DoubleDouble* a);
+int ddCompare(const DoubleDouble* a, const DoubleDouble* b);
+#endif
+
+inline void forceReal(Real r);
 inline void setReal_fast(Real r, double bytes);
 
+__attribute__((always_inline))
+inline
+void forceReal(Real r){
+  if (r->pending != NULL){
+    materializeReal(r);
+  }
+}
+
 __attribute__((always_inline))
 inline
 void setReal_fast(Real r, double bytes){
   if (no_reals) return;
   #ifdef USE_MPFR
+  if (use_double_double){
+    r->dd.hi = bytes;
+    r->dd.lo = 0.0;
+    r->dd.bits = DD_EXACT_BITS;
+    r->escalated = False;
+    return;
+  }
+  r->escalated = True;
+  if (adaptive_precision){
+    mpfr_set_prec_raw(r->mpfr_val, precision);
+  }
   mpfr_set_d(r->mpfr_val, bytes, MPFR_RNDN);
   #else
   mpf_set_d(r->mpf_val, bytes);
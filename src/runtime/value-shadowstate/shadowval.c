@@ -55,14 +55,45 @@ UWord hashDouble(double val){
   VG_(memcpy)(&result, &val, sizeof(UWord));
   return result;
 }
+// Shadow values never get freed, just recycled through freedVals, so
+// we carve them out of slabs, each one laid out right next to its
+// real and, without --double-double, the real's limbs. That's one allocation for every
+// SHADOW_VALUE_SLAB_COUNT values instead of three per value, and
+// keeps everything an operation touches on neighbouring lines.
+#define SHADOW_VALUE_SLAB_COUNT 256
+static char* valueSlabNext = NULL;
+static char* valueSlabEnd = NULL;
+static SizeT valueStride = 0;
+
+static void* allocFromValueSlab(void){
+  if (valueStride == 0){
+    valueStride = sizeof(ShadowValue);
+    if (!no_reals){
+      valueStride += realInlineSize();
+    }
+    valueStride = (valueStride + 15) & ~((SizeT)15);
+  }
+  if (valueSlabNext == valueSlabEnd){
+    valueSlabNext = VG_(perm_malloc)(valueStride * SHADOW_VALUE_SLAB_COUNT,
+                                     16);
+    valueSlabEnd = valueSlabNext + valueStride * SHADOW_VALUE_SLAB_COUNT;
+    if (print_allocs){
+      VG_(printf)("Allocated slab of %d shadow values at %p\n",
+                  SHADOW_VALUE_SLAB_COUNT, valueSlabNext);
+    }
+  }
+  void* result = valueSlabNext;
+  valueSlabNext += valueStride;
+  return result;
+}
+
 inline
 ShadowValue* newShadowValue(ValueType type){
-  ShadowValue* result =
-    VG_(perm_malloc)(sizeof(ShadowValue), vg_alignof(ShadowValue));
+  ShadowValue* result = allocFromValueSlab();
   result->type = type;
   result->ref_count = 1;
   if (!no_reals){
-    result->real = mkReal();
+    result->real = mkRealAt((char*)result + sizeof(ShadowValue));
   }
   return result;
 }
@@ -37,6 +37,7 @@
 #include "pub_tool_mallocfree.h"
 
 #include "../shadowop/influence-op.h"
+#include "../shadowop/realop.h"
 
 #include "../../options.h"
 #include "../../helper/debug.h"
@@ -44,15 +45,26 @@
 
 #include <math.h>
 
-int blockStateDirty = 0;
-
 ArgUnion computedArgs;
 
 ResultUnion computedResult;
 
+OpBatchSlot opBatchSlots[MAX_OP_BATCH];
+
 ShadowTemp* shadowTemps[MAX_TEMPS];
+UWord shadowTempGens[MAX_TEMPS];
+UWord curTempGen = 0;
+Stack* staleTemps;
+UWord numStaleTemps = 0;
 ShadowValue* shadowThreadState[MAX_THREADS][MAX_REGISTERS];
-TableValueEntry* shadowMemTable[LARGE_PRIME];
+ShadowSecondaryMap* shadowPrimaryMap[SHADOW_PRIMARY_SIZE];
+ShadowSecondaryMap distinguishedSecondaryMap;
+VgHashTable* auxShadowMap;
+ULong numShadowSlotsReclaimed = 0;
+ULong numSecondaryMapsReleased = 0;
+UChar shadowPresenceFilter[SHADOW_FILTER_SIZE];
+ULong numFilterChecks = 0;
+ULong numFilterHits = 0;
 
 Stack* freedTemps[MAX_TEMP_BLOCKS];
 Stack* freedVals;
@@ -67,47 +79,38 @@ void initValueShadowState(void){
   }
   freedVals = mkStack();
   tableEntries = mkStack();
+  staleTemps = mkStack();
+  for(UWord i = 0; i < SHADOW_PRIMARY_SIZE; ++i){
+    shadowPrimaryMap[i] = &distinguishedSecondaryMap;
+  }
+  auxShadowMap = VG_(HT_construct)("auxiliary shadow memory map");
   valueCacheSingle = VG_(HT_construct)("value cache single-precision");
   valueCacheDouble = VG_(HT_construct)("value cache double precision");
   initExprAllocator();
 }
 
-VG_REGPARM(2) void dynamicCleanup(int nentries, IRTemp* entries){
-  Bool hasEntriesToCleanup = False;
+VG_REGPARM(0) void reclaimStaleTemps(void){
   if (print_temp_moves){
-    for(int i = 0; i < nentries; ++i){
-      ShadowTemp* temp = shadowTemps[entries[i]];
-      if (temp == NULL) continue;
-      if (!hasEntriesToCleanup){
-        VG_(printf)("Freeing temp(s) %p", temp);
-        hasEntriesToCleanup = True;
-      } else {
-        VG_(printf)(", %p", temp);
-      }
-    }
-    if (hasEntriesToCleanup){
-      VG_(printf)("\n");
-    }
+    VG_(printf)("Reclaiming %lu stale temps\n", numStaleTemps);
   }
-  for(int i = 0; i < nentries; ++i){
-    ShadowTemp* temp = shadowTemps[entries[i]];
-    if (temp == NULL) continue;
-    for(int j = 0; j < INT(temp->num_blocks); ++j){
-      if (PRINT_VALUE_MOVES){
-        if (temp->values[j] != NULL){
-          VG_(printf)("Cleaning up value %p (old rc %lu) "
-                      "from temp %p, block %d in %d at end of block.\n",
-                      temp->values[j], temp->values[j]->ref_count,
-                      temp, j, entries[i]);
-        }
-      }
-      disownShadowValue(temp->values[j]);
-      temp->values[j] = NULL;
-    }
-    freeShadowTemp(temp);
-    shadowTemps[entries[i]] = NULL;
+  while(!stack_empty(staleTemps)){
+    disownShadowTemp((void*)stack_pop(staleTemps));
   }
-  blockStateDirty = 0;
+  numStaleTemps = 0;
+}
+ShadowTemp* getShadowTemp(IRTemp idx){
+  if (shadowTempGens[idx] != curTempGen){
+    return NULL;
+  }
+  return shadowTemps[idx];
+}
+void setShadowTemp(IRTemp idx, ShadowTemp* temp){
+  if (shadowTemps[idx] != NULL){
+    stack_push(staleTemps, (void*)shadowTemps[idx]);
+    numStaleTemps++;
+  }
+  shadowTemps[idx] = temp;
+  shadowTempGens[idx] = curTempGen;
 }
 inline
 ShadowValue* getTS(Int idx){
@@ -146,15 +149,72 @@ VG_REGPARM(2) ShadowTemp* dynamicLoad(Addr memSrc, FloatBlocks numBlocks){
     return NULL;
   }
 }
-VG_REGPARM(1) ShadowValue* getMemShadow(Addr64 addr){
-  int key = addr % LARGE_PRIME;
-  for(TableValueEntry* node = shadowMemTable[key];
-      node != NULL; node = node->next){
-    if (node->addr == addr){
-      return node->val;
-    }
+// Get the secondary map covering addr, without allocating. Pages
+// which have never held a shadow will give back the distinguished
+// secondary map, which should never be written to.
+static inline
+ShadowSecondaryMap* getSecondaryMap(Addr64 addr){
+  UWord page = addr >> SHADOW_PAGE_BITS;
+  if (page < SHADOW_PRIMARY_SIZE){
+    return shadowPrimaryMap[page];
+  }
+  ShadowSecondaryMap* auxEntry = VG_(HT_lookup)(auxShadowMap, page);
+  if (auxEntry == NULL){
+    return &distinguishedSecondaryMap;
+  }
+  return auxEntry;
+}
+// Get the secondary map covering addr, allocating a fresh one if
+// it's still the distinguished map.
+static
+ShadowSecondaryMap* getWritableSecondaryMap(Addr64 addr){
+  UWord page = addr >> SHADOW_PAGE_BITS;
+  ShadowSecondaryMap* secondary = getSecondaryMap(addr);
+  if (secondary != &distinguishedSecondaryMap){
+    return secondary;
+  }
+  secondary = VG_(calloc)("secondary shadow map", 1,
+                          sizeof(ShadowSecondaryMap));
+  secondary->page = page;
+  if (page < SHADOW_PRIMARY_SIZE){
+    shadowPrimaryMap[page] = secondary;
+  } else {
+    VG_(HT_add_node)(auxShadowMap, secondary);
+  }
+  if (print_allocs){
+    VG_(printf)("Allocated secondary shadow map %p for page %lX\n",
+                secondary, page);
+  }
+  return secondary;
+}
+#define SHADOW_SLOT_IDX(addr) \
+  (((addr) & (SHADOW_PAGE_SIZE - 1)) / sizeof(float))
+
+// These keep the live counts and the presence filter up to date, and
+// should be called whenever a slot goes from empty to full or back.
+static inline
+void noteSlotFilled(ShadowSecondaryMap* secondary, UWord slotIdx){
+  UWord chunk = slotIdx / SHADOW_SLOTS_PER_CHUNK;
+  secondary->num_live++;
+  if (secondary->chunk_live[chunk]++ == 0 &&
+      secondary->page < SHADOW_PRIMARY_SIZE){
+    UWord filterBit = secondary->page * SHADOW_CHUNKS_PER_PAGE + chunk;
+    shadowPresenceFilter[filterBit / 8] |= 1 << (filterBit % 8);
   }
-  return NULL;
+}
+static inline
+void noteSlotEmptied(ShadowSecondaryMap* secondary, UWord slotIdx){
+  UWord chunk = slotIdx / SHADOW_SLOTS_PER_CHUNK;
+  secondary->num_live--;
+  if (--secondary->chunk_live[chunk] == 0 &&
+      secondary->page < SHADOW_PRIMARY_SIZE){
+    UWord filterBit = secondary->page * SHADOW_CHUNKS_PER_PAGE + chunk;
+    shadowPresenceFilter[filterBit / 8] &= ~(1 << (filterBit % 8));
+  }
+}
+
+VG_REGPARM(1) ShadowValue* getMemShadow(Addr64 addr){
+  return getSecondaryMap(addr)->vals[SHADOW_SLOT_IDX(addr)];
 }
 VG_REGPARM(3) void setMemShadowTemp(Addr64 memDest,
                                     UWord size,
@@ -168,31 +228,197 @@ VG_REGPARM(3) void setMemShadowTemp(Addr64 memDest,
   }
 }
 void removeMemShadow(Addr64 addr){
-  int key = addr % LARGE_PRIME;
-  TableValueEntry* prevEntry = NULL;
-  for(TableValueEntry* node = shadowMemTable[key];
-      node != NULL; node = node->next){
-    if (node->addr == addr){
-      if (prevEntry == NULL){
-        shadowMemTable[key] = node->next;
-      } else {
-        prevEntry->next = node->next;
+  ShadowSecondaryMap* secondary = getSecondaryMap(addr);
+  ShadowValue** slot = &(secondary->vals[SHADOW_SLOT_IDX(addr)]);
+  if (*slot == NULL){
+    return;
+  }
+  if (PRINT_VALUE_MOVES){
+    VG_(printf)("Clearing %llX, which disowns %p (old rc %lu)\n",
+                addr, *slot, (*slot)->ref_count);
+  }
+  disownShadowValue(*slot);
+  *slot = NULL;
+  noteSlotEmptied(secondary, SHADOW_SLOT_IDX(addr));
+}
+// Put a secondary map that no longer holds any shadows back to the
+// distinguished map, and free it.
+static void releaseSecondaryMap(ShadowSecondaryMap* secondary){
+  tl_assert(secondary->num_live == 0);
+  if (secondary == &distinguishedSecondaryMap){
+    return;
+  }
+  if (secondary->page < SHADOW_PRIMARY_SIZE){
+    shadowPrimaryMap[secondary->page] = &distinguishedSecondaryMap;
+  } else {
+    VG_(HT_remove)(auxShadowMap, secondary->page);
+  }
+  if (print_allocs){
+    VG_(printf)("Releasing secondary shadow map %p for page %lX\n",
+                secondary, secondary->page);
+  }
+  VG_(free)(secondary);
+  numSecondaryMapsReleased++;
+}
+static void clearMemShadowRangeInternal(Addr64 start, SizeT size,
+                                        Bool reclaim){
+  // Any block that is even partly overwritten loses its shadow.
+  UWord endSlot = (start + size + sizeof(float) - 1) / sizeof(float);
+  for(UWord slot = start / sizeof(float); slot < endSlot;){
+    ShadowSecondaryMap* secondary = getSecondaryMap(slot * sizeof(float));
+    UWord chunkEnd =
+      (slot / SHADOW_SLOTS_PER_PAGE + 1) * SHADOW_SLOTS_PER_PAGE;
+    if (chunkEnd > endSlot){
+      chunkEnd = endSlot;
+    }
+    Bool wholePage =
+      slot % SHADOW_SLOTS_PER_PAGE == 0 &&
+      chunkEnd - slot == SHADOW_SLOTS_PER_PAGE;
+    for(; slot < chunkEnd && secondary->num_live > 0; ++slot){
+      ShadowValue** entry =
+        &(secondary->vals[slot % SHADOW_SLOTS_PER_PAGE]);
+      if (*entry != NULL){
+        disownShadowValue(*entry);
+        *entry = NULL;
+        noteSlotEmptied(secondary, slot % SHADOW_SLOTS_PER_PAGE);
+        if (reclaim){
+          numShadowSlotsReclaimed++;
+        }
       }
+    }
+    // When a whole page of memory dies, give its secondary map back
+    // too. We don't do this for partial pages, since stack frames and
+    // small heap blocks die and come back far too often for that to
+    // be worth it.
+    if (reclaim && wholePage){
+      releaseSecondaryMap(secondary);
+    }
+    slot = chunkEnd;
+  }
+}
+void clearMemShadowRange(Addr64 start, SizeT size){
+  clearMemShadowRangeInternal(start, size, False);
+}
+void reclaimMemShadowRange(Addr64 start, SizeT size){
+  clearMemShadowRangeInternal(start, size, True);
+}
+void printShadowFilterStats(void){
+  if (numFilterChecks == 0){
+    return;
+  }
+  VG_(umsg)("herbgrind: presence filter skipped %llu of %llu "
+            "shadow memory lookups (%llu%%).\n",
+            numFilterHits, numFilterChecks,
+            numFilterHits * 100 / numFilterChecks);
+}
+static void transferMemShadowRange(Addr64 dest, Addr64 src, SizeT size,
+                                   Bool move){
+  if (dest == src || size == 0){
+    return;
+  }
+  if ((dest - src) % sizeof(float) != 0){
+    // The blocks don't line up, so nothing that was a float in the
+    // source can be one in the destination.
+    clearMemShadowRange(dest, size);
+    if (move){
+      clearMemShadowRange(src, size);
+    }
+    return;
+  }
+  // Blocks on the edges of the destination which only get partly
+  // overwritten lose their shadows, the rest get the shadow of the
+  // matching source block.
+  if (dest % sizeof(float) != 0){
+    clearMemShadowRange(dest, 1);
+  }
+  if ((dest + size) % sizeof(float) != 0){
+    clearMemShadowRange(dest + size - 1, 1);
+  }
+  UWord firstSlot = (dest + sizeof(float) - 1) / sizeof(float);
+  UWord endSlot = (dest + size) / sizeof(float);
+  UWord numSlots = endSlot > firstSlot ? endSlot - firstSlot : 0;
+  Word slotDelta = ((Word)src - (Word)dest) / (Word)sizeof(float);
+  // If the ranges overlap with the destination above the source, we
+  // have to go backwards so we don't read blocks we've already
+  // overwritten.
+  Bool backwards = dest > src;
 
-      if (PRINT_VALUE_MOVES){
-        VG_(printf)("Clearing %llX", addr);
-        if (node->val != NULL){
-          VG_(printf)(", which disowns %p (old rc %lu)", node->val, node->val->ref_count);
-        }
-        VG_(printf)("\n");
+  // Consecutive copies of the same value (which are common, since
+  // shadow values for constants are shared) get their ref count
+  // bumped all at once.
+  ShadowValue* pendingVal = NULL;
+  UWord pendingOwns = 0;
+#define FLUSH_PENDING_OWNS()                    \
+  if (pendingOwns > 0){                         \
+    pendingVal->ref_count += pendingOwns;       \
+    pendingOwns = 0;                            \
+  }
+
+  for(UWord i = 0; i < numSlots; ++i){
+    UWord destSlot = backwards ? endSlot - 1 - i : firstSlot + i;
+    UWord srcSlot = destSlot + slotDelta;
+    ShadowSecondaryMap* srcSecondary =
+      getSecondaryMap(srcSlot * sizeof(float));
+    ShadowSecondaryMap* destSecondary =
+      getSecondaryMap(destSlot * sizeof(float));
+    if (srcSecondary->num_live == 0 && destSecondary->num_live == 0){
+      // Nothing to do until one of the two crosses into a new page.
+      UWord srcLeft = backwards ?
+        srcSlot % SHADOW_SLOTS_PER_PAGE + 1 :
+        SHADOW_SLOTS_PER_PAGE - srcSlot % SHADOW_SLOTS_PER_PAGE;
+      UWord destLeft = backwards ?
+        destSlot % SHADOW_SLOTS_PER_PAGE + 1 :
+        SHADOW_SLOTS_PER_PAGE - destSlot % SHADOW_SLOTS_PER_PAGE;
+      i += (srcLeft < destLeft ? srcLeft : destLeft) - 1;
+      continue;
+    }
+    ShadowValue** srcEntry =
+      &(srcSecondary->vals[srcSlot % SHADOW_SLOTS_PER_PAGE]);
+    ShadowValue* val = *srcEntry;
+    if (val != NULL){
+      destSecondary = getWritableSecondaryMap(destSlot * sizeof(float));
+    }
+    ShadowValue** destEntry =
+      &(destSecondary->vals[destSlot % SHADOW_SLOTS_PER_PAGE]);
+    if (*destEntry != NULL){
+      FLUSH_PENDING_OWNS();
+      disownShadowValue(*destEntry);
+      *destEntry = NULL;
+      noteSlotEmptied(destSecondary, destSlot % SHADOW_SLOTS_PER_PAGE);
+    }
+    if (val == NULL){
+      continue;
+    }
+    *destEntry = val;
+    noteSlotFilled(destSecondary, destSlot % SHADOW_SLOTS_PER_PAGE);
+    if (move){
+      *srcEntry = NULL;
+      noteSlotEmptied(srcSecondary, srcSlot % SHADOW_SLOTS_PER_PAGE);
+    } else {
+      if (val != pendingVal){
+        FLUSH_PENDING_OWNS();
+        pendingVal = val;
       }
-      disownShadowValue(node->val);
-      stack_push(tableEntries, (void*)node);
-      break;
+      pendingOwns++;
     }
-    prevEntry = node;
+  }
+  FLUSH_PENDING_OWNS();
+#undef FLUSH_PENDING_OWNS
+  if (move){
+    // Pick up any partial blocks at the edges of the source.
+    clearMemShadowRange(src, size);
+  }
+  if (PRINT_VALUE_MOVES){
+    VG_(printf)("%s shadows of %lu bytes from %llX to %llX\n",
+                move ? "Moved" : "Copied", size, src, dest);
   }
 }
+void copyMemShadowRange(Addr64 dest, Addr64 src, SizeT size){
+  transferMemShadowRange(dest, src, size, False);
+}
+void moveMemShadowRange(Addr64 dest, Addr64 src, SizeT size){
+  transferMemShadowRange(dest, src, size, True);
+}
 VG_REGPARM(0) TableValueEntry* newTableValueEntry(void){
   return VG_(malloc)("tableEntry", sizeof(TableValueEntry));
 }
@@ -206,20 +432,22 @@ inline TableValueEntry* mkTableEntry(void){
   return newEntry;
 }
 void addMemShadow(Addr64 addr, ShadowValue* val){
-  TableValueEntry* newEntry = mkTableEntry();
-  newEntry->addr = addr;
-  newEntry->val = val;
+  if (val == NULL){
+    removeMemShadow(addr);
+    return;
+  }
+  ShadowSecondaryMap* secondary = getWritableSecondaryMap(addr);
+  ShadowValue** slot = &(secondary->vals[SHADOW_SLOT_IDX(addr)]);
   ownShadowValue(val);
-
-  int key = addr % LARGE_PRIME;
-  newEntry->next = shadowMemTable[key];
-  shadowMemTable[key] = newEntry;
+  if (*slot == NULL){
+    noteSlotFilled(secondary, SHADOW_SLOT_IDX(addr));
+  } else {
+    disownShadowValue(*slot);
+  }
+  *slot = val;
   if (PRINT_VALUE_MOVES){
-    VG_(printf)("Setting %llX to %p", addr, val);
-    if (val != NULL){
-      VG_(printf)(" (new rc %lu)", val->ref_count);
-    }
-    VG_(printf)("\n");
+    VG_(printf)("Setting %llX to %p (new rc %lu)\n",
+                addr, val, val->ref_count);
   }
 }
 void freeShadowTemp(ShadowTemp* temp){
@@ -255,14 +483,20 @@ void freeShadowValue(ShadowValue* val){
     }
     disownConcExpr(val->expr);
   }
-  double value = getDouble(val->real);
-  if (value == 0.0) value = 0.0;
-  if (isNaN(val->real)) value = NAN;
-  TableValueEntry* entry =
-    VG_(HT_remove)(val->type == Vt_Single ? valueCacheSingle : valueCacheDouble,
-                   *(UWord*)&value);
-  if (entry != NULL){
-    stack_push(tableEntries, (void*)entry);
+  if (!no_reals && val->real->pending != NULL){
+    // Nothing ever read this value, so there's no point computing it
+    // now, and it can't be in the value cache.
+    dropPendingReal(val->real);
+  } else {
+    double value = getDouble(val->real);
+    if (value == 0.0) value = 0.0;
+    if (isNaN(val->real)) value = NAN;
+    TableValueEntry* entry =
+      VG_(HT_remove)(val->type == Vt_Single ? valueCacheSingle : valueCacheDouble,
+                     *(UWord*)&value);
+    if (entry != NULL){
+      stack_push(tableEntries, (void*)entry);
+    }
   }
   stack_push_fast(freedVals, (void*)val);
 }
@@ -274,8 +508,7 @@ ShadowValue* copyShadowValue(ShadowValue* val){
   }
   copy->expr = val->expr;
   if (!no_exprs){
-    recursivelyOwnConcExpr(copy->expr,
-                           max_expr_block_depth * 2);
+    ownConcExpr(copy->expr);
   }
   if (!no_influences){
     copy->influences = cloneInfluences(val->influences);
@@ -388,11 +621,29 @@ void disownShadowTemp(ShadowTemp* temp){
   }
   freeShadowTemp(temp);
 }
+// A slot from an earlier generation doesn't hold the temp this run
+// of the block means, so instead of disowning it, hand it to the
+// stale stack like a store over it would.
+static void dropStaleTemp(IRTemp idx){
+  if (shadowTemps[idx] != NULL){
+    stack_push(staleTemps, (void*)shadowTemps[idx]);
+    numStaleTemps++;
+    shadowTemps[idx] = NULL;
+  }
+}
 VG_REGPARM(1) void disownShadowTempNonNullDynamic(IRTemp idx){
+  if (shadowTempGens[idx] != curTempGen){
+    dropStaleTemp(idx);
+    return;
+  }
   disownShadowTemp(shadowTemps[idx]);
   shadowTemps[idx] = NULL;
 }
 VG_REGPARM(1) void disownShadowTempDynamic(IRTemp idx){
+  if (shadowTempGens[idx] != curTempGen){
+    dropStaleTemp(idx);
+    return;
+  }
   if (shadowTemps[idx] != NULL){
     disownShadowTemp(shadowTemps[idx]);
     shadowTemps[idx] = NULL;
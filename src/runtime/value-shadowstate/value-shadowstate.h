@@ -40,9 +40,13 @@
 //   limit set in the .h file.
 //
 // * Finally, values might be written to memory, and then read out
-//   later at some arbitrary point. For these, we'll maintain a hash
-//   table that maps addresses to shadow values, so we don't have to
-//   maintain a vast array of shadow values for all of memory.
+//   later at some arbitrary point. For these, we'll maintain a two
+//   level map in the style of memcheck: a primary map, indexed by the
+//   high bits of the address, points to secondary maps, each of which
+//   holds a dense array of shadow value slots for every 4-byte block
+//   of one page of client memory. Primary map entries for pages that
+//   have never held a shadow all point to a single, read-only,
+//   all-NULL secondary map, so a lookup is always just two loads.
 
 #ifndef _VALUE_SHADOWSTATE_H
 #define _VALUE_SHADOWSTATE_H
@@ -57,7 +61,39 @@
 
 #define MAX_THREADS 16
 
-#define LARGE_PRIME 1572869
+// Each secondary map covers 2^SHADOW_PAGE_BITS bytes of client
+// memory, and the primary map covers the bottom 2^SHADOW_MAP_BITS
+// bytes of the address space, which is where valgrind puts
+// everything on the platforms we support. Pages above that go in a
+// hash table, and are only looked up from C.
+#define SHADOW_PAGE_BITS 16
+#define SHADOW_PAGE_SIZE (1UL << SHADOW_PAGE_BITS)
+#define SHADOW_SLOTS_PER_PAGE (SHADOW_PAGE_SIZE / sizeof(float))
+#define SHADOW_MAP_BITS 37
+#define SHADOW_PRIMARY_SIZE (1UL << (SHADOW_MAP_BITS - SHADOW_PAGE_BITS))
+
+// On top of the maps, we keep a presence filter with a bit for every
+// 2^SHADOW_FILTER_CHUNK_BITS byte chunk of the memory the primary map
+// covers, which is set whenever some block in the chunk has a
+// shadow. Most loads and stores are of memory that's never been
+// shadowed, so the instrumentation checks this one bit before doing
+// any map lookups.
+#define SHADOW_FILTER_CHUNK_BITS 10
+#define SHADOW_SLOTS_PER_CHUNK ((1UL << SHADOW_FILTER_CHUNK_BITS) / sizeof(float))
+#define SHADOW_CHUNKS_PER_PAGE (1UL << (SHADOW_PAGE_BITS - SHADOW_FILTER_CHUNK_BITS))
+#define SHADOW_FILTER_SIZE (1UL << (SHADOW_MAP_BITS - SHADOW_FILTER_CHUNK_BITS - 3))
+
+typedef struct _ShadowSecondaryMap {
+  // For the auxiliary map of high pages, which is a VgHashTable.
+  struct _ShadowSecondaryMap* next;
+  UWord page;
+
+  UWord num_live;
+  // How many live slots each filter chunk of the page has, so we
+  // know when to clear its bit.
+  UShort chunk_live[SHADOW_CHUNKS_PER_PAGE];
+  ShadowValue* vals[SHADOW_SLOTS_PER_PAGE];
+} ShadowSecondaryMap;
 
 typedef struct _tableValueEntry {
   struct _tableValueEntry* next;
@@ -85,9 +121,39 @@ extern ArgUnion computedArgs;
 
 extern ResultUnion computedResult;
 
+// With --batch-ops, the client values of each operation in a batch
+// go in their own slot, since they aren't used until the end of the
+// batch. Like computedArgs, one set of slots is enough, since a batch
+// never outlives the run of the block that fills it.
+#define MAX_OP_BATCH 32
+typedef struct {
+  ArgUnion args;
+  ResultUnion result;
+} OpBatchSlot;
+extern OpBatchSlot opBatchSlots[MAX_OP_BATCH];
+
 extern ShadowTemp* shadowTemps[MAX_TEMPS];
+// Shadow temps only live for one run of a superblock. Instead of
+// clearing them out every time a block exits, each run of a block
+// gets a new generation number, and a temp slot only counts if it
+// was stored in the current generation. A slot keeps ownership of
+// its stale temp until it's overwritten, cleared or disowned, at
+// which point the temp goes on the staleTemps stack, which gets
+// reclaimed in batches of STALE_TEMP_BATCH.
+#define STALE_TEMP_BATCH 256
+extern UWord shadowTempGens[MAX_TEMPS];
+extern UWord curTempGen;
+extern Stack* staleTemps;
+extern UWord numStaleTemps;
 extern ShadowValue* shadowThreadState[MAX_THREADS][MAX_REGISTERS];
-extern TableValueEntry* shadowMemTable[LARGE_PRIME];
+extern ShadowSecondaryMap* shadowPrimaryMap[SHADOW_PRIMARY_SIZE];
+extern ShadowSecondaryMap distinguishedSecondaryMap;
+extern VgHashTable* auxShadowMap;
+extern ULong numShadowSlotsReclaimed;
+extern ULong numSecondaryMapsReleased;
+extern UChar shadowPresenceFilter[SHADOW_FILTER_SIZE];
+extern ULong numFilterChecks;
+extern ULong numFilterHits;
 
 extern Stack* freedTemps[MAX_TEMP_BLOCKS];
 extern Stack* freedVals;
@@ -100,10 +166,10 @@ typedef struct _Word256 {
 } Word256;
 extern Word256 getBytes;
 
-extern int blockStateDirty;
-
 void initValueShadowState(void);
-VG_REGPARM(2) void dynamicCleanup(int nentries, IRTemp* entries);
+VG_REGPARM(0) void reclaimStaleTemps(void);
+ShadowTemp* getShadowTemp(IRTemp idx);
+void setShadowTemp(IRTemp idx, ShadowTemp* temp);
 VG_REGPARM(2) void dynamicPut(Int tsDest, ShadowTemp* st);
 VG_REGPARM(2) ShadowTemp* dynamicGet64(Int tsSrc,
                                        UWord tsBytes);
@@ -117,6 +183,16 @@ VG_REGPARM(3) void setMemShadowTemp(Addr64 memDest, UWord size,
 VG_REGPARM(1) ShadowValue* getMemShadow(Addr64 memSrc);
 void removeMemShadow(Addr64 addr);
 void addMemShadow(Addr64 addr, ShadowValue* val);
+// Bulk operations on ranges of shadow memory, for the wrappers
+// around the libc memory functions. Copying has memmove semantics,
+// and moving leaves the source range with no shadows.
+void clearMemShadowRange(Addr64 start, SizeT size);
+void copyMemShadowRange(Addr64 dest, Addr64 src, SizeT size);
+void moveMemShadowRange(Addr64 dest, Addr64 src, SizeT size);
+// Clear the shadows of memory that has died (been freed, unmapped, or
+// popped off the stack), releasing any pages that end up empty.
+void reclaimMemShadowRange(Addr64 start, SizeT size);
+void printShadowFilterStats(void);
 
 VG_REGPARM(1) void disownShadowTempNonNull(ShadowTemp* temp);
 VG_REGPARM(1) void disownShadowTemp(ShadowTemp* temp);
@@ -0,0 +1,88 @@
+/*--------------------------------------------------------------------*/
+/*--- Herbgrind: a valgrind tool for Herbie        mem-intercept.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Herbgrind, a valgrind tool for diagnosing
+   floating point accuracy problems in binary programs and extracting
+   problematic expressions.
+
+   Copyright (C) 2016-2017 Alex Sanchez-Stern
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 3 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#include "mem-intercept.h"
+#include "../value-shadowstate/value-shadowstate.h"
+
+#include "pub_tool_aspacemgr.h"
+#include "pub_tool_libcbase.h"
+#include "pub_tool_libcprint.h"
+#include "pub_tool_vki.h"
+
+Bool performWrappedMemmove(Addr dest, Addr src, SizeT size){
+  if (size == 0){
+    return True;
+  }
+  if (!VG_(am_is_valid_for_client)(src, size, VKI_PROT_READ) ||
+      !VG_(am_is_valid_for_client)(dest, size, VKI_PROT_WRITE)){
+    return False;
+  }
+  VG_(memmove)((void*)dest, (void*)src, size);
+  copyMemShadowRange(dest, src, size);
+  return True;
+}
+Bool performWrappedMemset(Addr dest, Int c, SizeT size){
+  if (size == 0){
+    return True;
+  }
+  if (!VG_(am_is_valid_for_client)(dest, size, VKI_PROT_WRITE)){
+    return False;
+  }
+  VG_(memset)((void*)dest, c, size);
+  clearMemShadowRange(dest, size);
+  return True;
+}
+void performWrappedRealloc(Addr oldBlock, SizeT oldSize,
+                           Addr newBlock, SizeT newSize){
+  if (newBlock == oldBlock){
+    // Resized in place, so the only thing that can have changed is
+    // that the tail got cut off.
+    if (newSize < oldSize){
+      clearMemShadowRange(oldBlock + newSize, oldSize - newSize);
+    }
+    return;
+  }
+  // The allocator has already copied the bytes across (and freed the
+  // old block), so all that's left is to bring the shadows along.
+  moveMemShadowRange(newBlock, oldBlock,
+                     oldSize < newSize ? oldSize : newSize);
+  reclaimMemShadowRange(oldBlock, oldSize);
+}
+void performWrappedFree(Addr block, SizeT size){
+  reclaimMemShadowRange(block, size);
+}
+void dieMemShadows(Addr start, SizeT size){
+  reclaimMemShadowRange(start, size);
+}
+void printMemReclaimStats(void){
+  VG_(umsg)("herbgrind: reclaimed %llu shadow slots from dead memory, "
+            "and released %llu secondary maps (%llu bytes).\n",
+            numShadowSlotsReclaimed, numSecondaryMapsReleased,
+            numSecondaryMapsReleased * sizeof(ShadowSecondaryMap));
+}
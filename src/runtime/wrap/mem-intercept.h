@@ -0,0 +1,54 @@
+/*--------------------------------------------------------------------*/
+/*--- Herbgrind: a valgrind tool for Herbie        mem-intercept.h ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Herbgrind, a valgrind tool for diagnosing
+   floating point accuracy problems in binary programs and extracting
+   problematic expressions.
+
+   Copyright (C) 2016-2017 Alex Sanchez-Stern
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 3 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#ifndef _MEM_INTERCEPT_H
+#define _MEM_INTERCEPT_H
+
+#include "pub_tool_basics.h"
+
+// These are called from the client requests that the libc memory
+// function wrappers in helper/memwrap.c make. The memmove and memset
+// ones do the actual byte operation on the tool side, so that the
+// instrumented client never sees the individual loads and stores,
+// and then fix up shadow memory for the whole range at once. They
+// return False if the client memory isn't accessible, in which case
+// the wrapper does the operation itself so that it faults in the
+// client like it should.
+Bool performWrappedMemmove(Addr dest, Addr src, SizeT size);
+Bool performWrappedMemset(Addr dest, Int c, SizeT size);
+void performWrappedRealloc(Addr oldBlock, SizeT oldSize,
+                           Addr newBlock, SizeT newSize);
+void performWrappedFree(Addr block, SizeT size);
+
+// Valgrind calls this when client memory dies, from stack frames
+// being popped, or memory being unmapped or given back with brk.
+void dieMemShadows(Addr start, SizeT size);
+void printMemReclaimStats(void);
+
+#endif